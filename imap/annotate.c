@@ -63,6 +63,7 @@
 
 #include "acl.h"
 #include "assert.h"
+#include "bloom.h"
 #include "cyrusdb.h"
 #include "exitcodes.h"
 #include "glob.h"
@@ -219,8 +220,16 @@ struct annotate_db
     struct db *db;
     struct txn *txn;
     int in_txn;
+    /* message uids with annotations, see annotate_db_may_have_uid() */
+    struct bloom uids;
+    modseq_t uids_modseq;
+    unsigned uids_lookups;
 };
 
+/* number of message lookups in one db before it's worth reading
+ * the whole db to build its uid filter */
+#define ANNOTATE_UIDS_MINLOOKUPS 64
+
 #define DB config_annotation_db
 
 static annotate_db_t *all_dbs_head = NULL;
@@ -713,6 +722,7 @@ static void annotate_closedb(annotate_db_t *d)
         syslog(LOG_ERR, "DBERROR: error closing annotations %s: %s",
                d->filename, cyrusdb_strerror(r));
 
+    bloom_free(&d->uids);
     free(d->filename);
     free(d->mboxname);
     memset(d, 0, sizeof(*d));   /* JIC */
@@ -766,8 +776,67 @@ EXPORTED void annotatemore_close(void)
  * times */
 static void annotate_begin(annotate_db_t *d)
 {
-    if (d)
+    if (d) {
         d->in_txn = 1;
+        /* we're about to change it, so the uid filter is stale */
+        bloom_free(&d->uids);
+    }
+}
+
+static int uids_cb(void *rock,
+                   const char *key, size_t keylen __attribute__((unused)),
+                   const char *data __attribute__((unused)),
+                   size_t datalen __attribute__((unused)))
+{
+    struct bloom *bloom = (struct bloom *) rock;
+    /* per-mailbox keys start with the NUL-terminated uid */
+    uint32_t uid = strtoul(key, NULL, 10);
+
+    if (uid) bloom_add(bloom, &uid, sizeof(uid));
+
+    return 0;
+}
+
+/*
+ * Returns 0 if message 'uid' of 'mailbox' definitely has no annotations
+ * in its per-mailbox db 'd', otherwise 1.
+ *
+ * Most messages have no annotations, so once many messages of a mailbox
+ * are looked up, the db is read once to build a bloom filter of the
+ * uids in it.  Message annotations only change with the mailbox locked
+ * for writing, and every change bumps its highestmodseq, so the filter
+ * is good for as long as we hold the lock and highestmodseq is unchanged
+ * (or until we write to the db ourselves, see annotate_begin()).
+ */
+static int annotate_db_may_have_uid(annotate_db_t *d, struct mailbox *mailbox,
+                                    uint32_t uid)
+{
+    int r;
+
+    if (!d || !d->mboxname || d->in_txn || !mailbox ||
+        !mailbox_index_islocked(mailbox, /*write*/0))
+        return 1;
+
+    if (d->uids.ready && d->uids_modseq != mailbox->i.highestmodseq)
+        bloom_free(&d->uids);
+
+    if (!d->uids.ready) {
+        if (++d->uids_lookups < ANNOTATE_UIDS_MINLOOKUPS)
+            return 1;
+        d->uids_lookups = 0;
+
+        if (bloom_init(&d->uids, MAX(mailbox->i.exists, 1024), 0.01))
+            return 1;
+
+        r = cyrusdb_foreach(d->db, "", 0, NULL, uids_cb, &d->uids, tid(d));
+        if (r) {
+            bloom_free(&d->uids);
+            return 1;
+        }
+        d->uids_modseq = mailbox->i.highestmodseq;
+    }
+
+    return (bloom_check(&d->uids, &uid, sizeof(uid)) != 0);
 }
 
 static void annotate_abort(annotate_db_t *d)
@@ -1813,7 +1882,11 @@ static void annotation_get_fromdb(annotate_state_t *state,
     const char *mboxname = (state->mailbox ? state->mailbox->name : "");
     state->found = 0;
 
-    annotatemore_findall(mboxname, state->uid, entry->name, 0, &rw_cb, state, 0);
+    if (state->which != ANNOTATION_SCOPE_MESSAGE ||
+        annotate_db_may_have_uid(state->d, state->mailbox, state->uid)) {
+        annotatemore_findall(mboxname, state->uid, entry->name, 0,
+                             &rw_cb, state, 0);
+    }
 
     if (state->found != state->attribs &&
         (!strchr(entry->name, '%') && !strchr(entry->name, '*'))) {
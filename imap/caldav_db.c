@@ -262,7 +262,7 @@ static unsigned _comp_flags_to_num(struct comp_flags *flags)
     "SELECT rowid, creationdate, mailbox, resource, imap_uid,"          \
     "  lock_token, lock_owner, lock_ownerid, lock_expire,"              \
     "  comp_type, ical_uid, organizer, dtstart, dtend,"                 \
-    "  comp_flags, sched_tag, alive, modseq"                            \
+    "  comp_flags, sched_tag, alive, modseq, occurs_start, occurs_horizon" \
     " FROM ical_objs"                                                   \
 
 static int read_cb(sqlite3_stmt *stmt, void *rock)
@@ -285,6 +285,8 @@ static int read_cb(sqlite3_stmt *stmt, void *rock)
     cdata->dav.lock_expire = sqlite3_column_int(stmt, 8);
     cdata->comp_type = sqlite3_column_int(stmt, 9);
     _num_to_comp_flags(&cdata->comp_flags, sqlite3_column_int(stmt, 14));
+    cdata->occurs_start = sqlite3_column_int64(stmt, 18);
+    cdata->occurs_horizon = sqlite3_column_int64(stmt, 19);
 
     if (rrock->cb) {
         /* We can use the column data directly for the callback */
@@ -489,17 +491,65 @@ EXPORTED int caldav_foreach_timerange(struct caldav_db *caldavdb,
 }
 
 
+EXPORTED int caldav_occurrences_indexed(struct caldav_data *cdata,
+                                        time_t after, time_t before)
+{
+    return (cdata->occurs_horizon &&
+            after >= cdata->occurs_start && before <= cdata->occurs_horizon);
+}
+
+struct occurrence_rock {
+    caldav_occurrence_cb_t *cb;
+    void *rock;
+};
+
+static int occurrence_cb(sqlite3_stmt *stmt, void *rock)
+{
+    struct occurrence_rock *orock = (struct occurrence_rock *) rock;
+    struct caldav_occurrence occ;
+
+    occ.recurid = (const char *) sqlite3_column_text(stmt, 0);
+    occ.dtstart = (const char *) sqlite3_column_text(stmt, 1);
+    occ.dtend = (const char *) sqlite3_column_text(stmt, 2);
+    occ.transp = sqlite3_column_int(stmt, 3);
+    occ.status = sqlite3_column_int(stmt, 4);
+
+    return orock->cb(orock->rock, &occ);
+}
+
+#define CMD_SELOCCURS                                                   \
+    "SELECT recurid, dtstart, dtend, transp, status FROM ical_occurs"   \
+    " WHERE objid = :objid AND utc_start < :before AND utc_end > :after" \
+    " ORDER BY utc_start;"
+
+EXPORTED int caldav_foreach_occurrence(struct caldav_db *caldavdb,
+                                       unsigned rowid,
+                                       time_t after, time_t before,
+                                       caldav_occurrence_cb_t *cb, void *rock)
+{
+    struct sqldb_bindval bval[] = {
+        { ":objid",  SQLITE_INTEGER, { .i = rowid  } },
+        { ":after",  SQLITE_INTEGER, { .i = after  } },
+        { ":before", SQLITE_INTEGER, { .i = before } },
+        { NULL,      SQLITE_NULL,    { .s = NULL   } } };
+    struct occurrence_rock orock = { cb, rock };
+
+    return sqldb_exec(caldavdb->db, CMD_SELOCCURS, bval,
+                      &occurrence_cb, &orock);
+}
+
+
 #define CMD_INSERT                                                      \
     "INSERT INTO ical_objs ("                                           \
     "  alive, mailbox, resource, creationdate, imap_uid, modseq,"       \
     "  lock_token, lock_owner, lock_ownerid, lock_expire,"              \
     "  comp_type, ical_uid, organizer, dtstart, dtend,"                 \
-    "  comp_flags, sched_tag )"                                         \
+    "  comp_flags, sched_tag, occurs_start, occurs_horizon )"           \
     " VALUES ("                                                         \
     "  :alive, :mailbox, :resource, :creationdate, :imap_uid, :modseq," \
     "  :lock_token, :lock_owner, :lock_ownerid, :lock_expire,"          \
     "  :comp_type, :ical_uid, :organizer, :dtstart, :dtend,"            \
-    "  :comp_flags, :sched_tag );"
+    "  :comp_flags, :sched_tag, :occurs_start, :occurs_horizon );"
 
 #define CMD_UPDATE                      \
     "UPDATE ical_objs SET"              \
@@ -517,7 +567,9 @@ EXPORTED int caldav_foreach_timerange(struct caldav_db *caldavdb,
     "  dtstart      = :dtstart,"        \
     "  dtend        = :dtend,"          \
     "  comp_flags   = :comp_flags,"     \
-    "  sched_tag    = :sched_tag"       \
+    "  sched_tag    = :sched_tag,"      \
+    "  occurs_start = :occurs_start,"   \
+    "  occurs_horizon = :occurs_horizon" \
     " WHERE rowid = :rowid;"
 
 EXPORTED int caldav_write(struct caldav_db *caldavdb, struct caldav_data *cdata)
@@ -542,6 +594,8 @@ EXPORTED int caldav_write(struct caldav_db *caldavdb, struct caldav_data *cdata)
         { ":dtend",        SQLITE_TEXT,    { .s = cdata->dtend            } },
         { ":sched_tag",    SQLITE_TEXT,    { .s = cdata->sched_tag        } },
         { ":comp_flags",   SQLITE_INTEGER, { .i = comp_flags              } },
+        { ":occurs_start", SQLITE_INTEGER, { .i = cdata->occurs_start     } },
+        { ":occurs_horizon", SQLITE_INTEGER, { .i = cdata->occurs_horizon } },
         { NULL,            SQLITE_NULL,    { .s = NULL                    } } };
 
     if (cdata->dav.rowid) {
@@ -643,6 +697,125 @@ static void check_mattach_cb(icalcomponent *comp, void *rock)
     }
 }
 
+/* Upper bound on the number of occurrences we will index per resource */
+#define CALDAV_OCCURS_MAX  10000
+
+struct index_rock {
+    struct caldav_db *db;
+    unsigned objid;
+    unsigned count;
+    int toomany;
+    int r;
+};
+
+#define CMD_INSERTOCC                                                   \
+    "INSERT INTO ical_occurs ("                                         \
+    "  objid, recurid, dtstart, dtend, utc_start, utc_end,"             \
+    "  transp, status )"                                                \
+    " VALUES ("                                                         \
+    "  :objid, :recurid, :dtstart, :dtend, :utc_start, :utc_end,"       \
+    "  :transp, :status );"
+
+static int index_occurrence_cb(icalcomponent *comp,
+                               icaltimetype start, icaltimetype end,
+                               void *rock)
+{
+    struct index_rock *irock = (struct index_rock *) rock;
+    icaltimezone *utc = icaltimezone_get_utc_timezone();
+    struct icaltimetype recurid;
+    unsigned transp = 0, status = CAL_STATUS_BUSY;
+    icalproperty *prop;
+    char *recurid_str, *start_str, *end_str;
+
+    if (++irock->count > CALDAV_OCCURS_MAX) {
+        irock->toomany = 1;
+        return 0;
+    }
+
+    start = icaltime_convert_to_zone(start, utc);
+    end = icaltime_convert_to_zone(end, utc);
+
+    recurid = icalcomponent_get_recurrenceid_with_zone(comp);
+    if (icaltime_is_null_time(recurid)) recurid = start;
+    else {
+        recurid = icaltime_convert_to_zone(recurid, utc);
+        recurid.is_date = 0;  /* make DATE-TIME for comparison */
+    }
+
+    /* Same TRANSP test as is applied to expanded occurrences
+       when calculating busytime */
+    prop = icalcomponent_get_first_property(comp, ICAL_TRANSP_PROPERTY);
+    if (prop && icalproperty_get_transp(prop) == ICAL_TRANSP_TRANSPARENT)
+        transp = 1;
+
+    switch (icalcomponent_get_status(comp)) {
+    case ICAL_STATUS_CANCELLED: status = CAL_STATUS_CANCELED; break;
+    case ICAL_STATUS_TENTATIVE: status = CAL_STATUS_TENTATIVE; break;
+    default: break;
+    }
+
+    /* icaltime_as_ical_string() returns a ring buffer, so copy */
+    recurid_str = xstrdup(icaltime_as_ical_string(recurid));
+    start_str = xstrdup(icaltime_as_ical_string(start));
+    end_str = xstrdup(icaltime_as_ical_string(end));
+
+    struct sqldb_bindval bval[] = {
+        { ":objid",     SQLITE_INTEGER, { .i = irock->objid } },
+        { ":recurid",   SQLITE_TEXT,    { .s = recurid_str  } },
+        { ":dtstart",   SQLITE_TEXT,    { .s = start_str    } },
+        { ":dtend",     SQLITE_TEXT,    { .s = end_str      } },
+        { ":utc_start", SQLITE_INTEGER,
+          { .i = icaltime_as_timet_with_zone(start, utc) } },
+        { ":utc_end",   SQLITE_INTEGER,
+          { .i = icaltime_as_timet_with_zone(end, utc) } },
+        { ":transp",    SQLITE_INTEGER, { .i = transp       } },
+        { ":status",    SQLITE_INTEGER, { .i = status       } },
+        { NULL,         SQLITE_NULL,    { .s = NULL         } } };
+
+    irock->r = sqldb_exec(irock->db->db, CMD_INSERTOCC, bval, NULL, NULL);
+
+    free(recurid_str);
+    free(start_str);
+    free(end_str);
+
+    return !irock->r;
+}
+
+#define CMD_DELOCCURS "DELETE FROM ical_occurs WHERE objid = :objid;"
+
+/* Rebuild the occurrence index for a (recurring) resource */
+static int caldav_index_occurrences(struct caldav_db *caldavdb,
+                                    struct caldav_data *cdata,
+                                    icalcomponent *ical)
+{
+    struct sqldb_bindval bval[] = {
+        { ":objid", SQLITE_INTEGER, { .i = cdata->dav.rowid } },
+        { NULL,     SQLITE_NULL,    { .s = NULL             } } };
+    struct index_rock irock = { caldavdb, cdata->dav.rowid, 0, 0, 0 };
+    icaltimezone *utc = icaltimezone_get_utc_timezone();
+    struct icalperiodtype range;
+    int r;
+
+    r = sqldb_exec(caldavdb->db, CMD_DELOCCURS, bval, NULL, NULL);
+    if (r || !cdata->occurs_horizon) return r;
+
+    range.start = icaltime_from_timet_with_zone(cdata->occurs_start, 0, utc);
+    range.end = icaltime_from_timet_with_zone(cdata->occurs_horizon, 0, utc);
+    range.duration = icaldurationtype_null_duration();
+
+    icalcomponent_myforeach(ical, range, NULL, &index_occurrence_cb, &irock);
+
+    if (irock.toomany) {
+        /* Too many occurrences - don't index this resource at all */
+        cdata->occurs_start = cdata->occurs_horizon = 0;
+        r = sqldb_exec(caldavdb->db, CMD_DELOCCURS, bval, NULL, NULL);
+        if (!r) r = caldav_write(caldavdb, cdata);
+    }
+    else r = irock.r;
+
+    return r;
+}
+
 EXPORTED int caldav_writeentry(struct caldav_db *caldavdb, struct caldav_data *cdata,
                                icalcomponent *ical)
 {
@@ -725,8 +898,31 @@ EXPORTED int caldav_writeentry(struct caldav_db *caldavdb, struct caldav_data *c
     cdata->dtend = icaltime_as_ical_string(span.end);
     cdata->comp_flags.recurring = recurring;
     cdata->comp_flags.mattach = mattach;
-    
-    return caldav_write(caldavdb, cdata);
+
+    /* Expanded occurrences of recurring events are indexed across a
+       rolling window around the present so that free-busy lookups
+       needn't parse them.  Rewriting a long-running event only
+       re-expands the window, not its whole history. */
+    cdata->occurs_start = cdata->occurs_horizon = 0;
+    if (recurring && mykind == CAL_COMP_VEVENT) {
+        int days = config_getint(IMAPOPT_CALDAV_OCCURRENCE_HORIZON);
+
+        if (days > 0) {
+            int history = config_getint(IMAPOPT_CALDAV_OCCURRENCE_HISTORY);
+            time_t now = time(NULL);
+            time_t start = now - (time_t) history * 24 * 60 * 60;
+            time_t horizon = now + (time_t) days * 24 * 60 * 60;
+
+            cdata->occurs_start = start > caldav_epoch ? start : caldav_epoch;
+            cdata->occurs_horizon =
+                horizon < caldav_eternity ? horizon : caldav_eternity;
+        }
+    }
+
+    int r = caldav_write(caldavdb, cdata);
+    if (!r) r = caldav_index_occurrences(caldavdb, cdata, ical);
+
+    return r;
 }
 
 
@@ -101,10 +101,23 @@ struct caldav_data {
     const char *dtend;
     struct comp_flags comp_flags;
     const char *sched_tag;
+    time_t occurs_start;    /* occurrences indexed from this time... */
+    time_t occurs_horizon;  /* ...up to this time (0=none) */
 };
 
 typedef int caldav_cb_t(void *rock, struct caldav_data *cdata);
 
+/* A single indexed occurrence of a recurring component */
+struct caldav_occurrence {
+    const char *recurid;
+    const char *dtstart;
+    const char *dtend;
+    unsigned transp;
+    unsigned status;
+};
+
+typedef int caldav_occurrence_cb_t(void *rock, struct caldav_occurrence *occ);
+
 /* prepare for caldav operations in this process */
 int caldav_init(void);
 
@@ -149,6 +162,18 @@ int caldav_foreach_timerange(struct caldav_db *caldavdb, const char *mailbox,
                              time_t after, time_t before,
                              caldav_cb_t *cb, void *rock);
 
+/* are all occurrences of the resource 'cdata' which end after 'after'
+ * and start before 'before' in the occurrence index? */
+int caldav_occurrences_indexed(struct caldav_data *cdata,
+                               time_t after, time_t before);
+
+/* process each indexed occurrence of the resource at 'rowid' in 'caldavdb'
+ * with cb() which ends after 'after' and starts before 'before'.
+ * Only valid if caldav_occurrences_indexed() is true for the range. */
+int caldav_foreach_occurrence(struct caldav_db *caldavdb, unsigned rowid,
+                              time_t after, time_t before,
+                              caldav_occurrence_cb_t *cb, void *rock);
+
 /* write an entry to 'caldavdb' */
 int caldav_write(struct caldav_db *caldavdb, struct caldav_data *cdata);
 int caldav_writeentry(struct caldav_db *caldavdb, struct caldav_data *cdata,
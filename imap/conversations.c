@@ -106,6 +106,9 @@ static char *convdir = NULL;
 static char *suffix = NULL;
 
 static int check_msgid(const char *msgid, size_t len, size_t *lenp);
+static int folder_number(struct conversations_state *state,
+                         const char *name,
+                         int create_flag);
 static int _conversations_parse(const char *data, size_t datalen,
                                 arrayu64_t *cids, time_t *stampp);
 static int _conversations_set_key(struct conversations_state *state,
@@ -204,6 +207,7 @@ EXPORTED int conversations_open_path(const char *fname, const char *userid, stru
     }
 
     open = xzmalloc(sizeof(struct conversations_open));
+    open->s.batch_folder = -1;
 
     r = cyrusdb_open(DB, fname, CYRUSDB_CREATE | CYRUSDB_CONVERT, &open->s.db);
     if (r || open->s.db == NULL) {
@@ -328,9 +332,137 @@ static void _conv_remove(struct conversations_state *state)
     fatal("unknown conversation db closed", EC_SOFTWARE);
 }
 
+struct conv_batched {
+    int delta_unseen;
+    modseq_t modseq;
+    int delta_counts[1];        /* actually counted_flags->count */
+};
+
+static void conv_batched_free(void *data)
+{
+    free(data);
+}
+
+/* IRIS-2534: check if it's the trash folder - XXX - should be separate
+ * conversation root or similar more useful method in future */
+static int conversations_is_trash(const char *mboxname, int *is_trash)
+{
+    mbname_t *mbname = mbname_from_intname(mboxname);
+    if (!mbname)
+        return IMAP_MAILBOX_BADNAME;
+
+    const strarray_t *boxes = mbname_boxes(mbname);
+    *is_trash = (strarray_size(boxes) == 1 &&
+                 !strcmpsafe(strarray_nth(boxes, 0), "Trash"));
+
+    mbname_free(&mbname);
+    return 0;
+}
+
+EXPORTED void conversations_batch_begin(struct conversations_state *state,
+                                        struct mailbox *mailbox)
+{
+    if (state->batch_folder >= 0) return;
+
+    state->batch_folder = folder_number(state, mailbox->name, /*create*/1);
+    state->batch_is_trash = 0;
+    if (conversations_is_trash(mailbox->name, &state->batch_is_trash)) {
+        /* let conversations_update_record() report the bad name */
+        state->batch_folder = -1;
+        return;
+    }
+    construct_hashu64_table(&state->batch, mailbox->i.exists/4+16, 0);
+}
+
+/* sum the count changes of one flag-only record update into the batch */
+static void conversations_batch_record(struct conversations_state *state,
+                                       struct mailbox *mailbox,
+                                       const struct index_record *old,
+                                       const struct index_record *new)
+{
+    struct conv_batched *batched = hashu64_lookup(new->cid, &state->batch);
+    int ncounted = state->counted_flags ? state->counted_flags->count : 0;
+    int i;
+
+    if (!batched) {
+        batched = xzmalloc(sizeof(struct conv_batched) +
+                           sizeof(int) * (ncounted ? ncounted - 1 : 0));
+        hashu64_insert(new->cid, batched, &state->batch);
+    }
+
+    batched->modseq = MAX(batched->modseq, new->modseq);
+
+    /* expunged records don't count, and neither end of this is live */
+    if (new->system_flags & FLAG_EXPUNGED)
+        return;
+
+    /* drafts don't update the 'unseen' counter so that
+     * they never turn a conversation "unread" */
+    if (!state->batch_is_trash) {
+        if (!(old->system_flags & (FLAG_SEEN|FLAG_DRAFT)))
+            batched->delta_unseen--;
+        if (!(new->system_flags & (FLAG_SEEN|FLAG_DRAFT)))
+            batched->delta_unseen++;
+    }
+
+    for (i = 0; i < ncounted; i++) {
+        const char *flag = strarray_nth(state->counted_flags, i);
+        batched->delta_counts[i] += mailbox_record_hasflag(mailbox, new, flag)
+                                  - mailbox_record_hasflag(mailbox, old, flag);
+    }
+}
+
+struct batch_rock {
+    struct conversations_state *state;
+    const char *mboxname;
+    int r;
+};
+
+static void batch_apply_cb(uint64_t cid, void *data, void *rock)
+{
+    struct conv_batched *batched = (struct conv_batched *) data;
+    struct batch_rock *brock = (struct batch_rock *) rock;
+    conversation_t *conv = NULL;
+    int r;
+
+    if (brock->r) return;
+
+    r = conversation_load(brock->state, cid, &conv);
+    if (!r && !conv) conv = conversation_new(brock->state);
+    if (!r) {
+        conversation_update(brock->state, conv, brock->mboxname,
+                            /*num_records*/0, /*exists*/0,
+                            batched->delta_unseen, /*size*/0,
+                            batched->delta_counts, batched->modseq);
+        r = conversation_save(brock->state, cid, conv);
+    }
+
+    conversation_free(conv);
+    brock->r = r;
+}
+
+EXPORTED int conversations_batch_end(struct conversations_state *state)
+{
+    struct batch_rock brock = { state, NULL, 0 };
+
+    if (state->batch_folder < 0) return 0;
+
+    brock.mboxname = strarray_nth(state->folder_names, state->batch_folder);
+    hashu64_enumerate(&state->batch, batch_apply_cb, &brock);
+
+    free_hashu64_table(&state->batch, conv_batched_free);
+    state->batch_folder = -1;
+
+    return brock.r;
+}
+
 static void conversations_abortcache(struct conversations_state *state)
 {
     /* still gotta clean up */
+    if (state->batch_folder >= 0) {
+        free_hashu64_table(&state->batch, conv_batched_free);
+        state->batch_folder = -1;
+    }
     free_hash_table(&state->folderstatus, free);
 }
 
@@ -383,6 +515,14 @@ EXPORTED int conversations_commit(struct conversations_state **statep)
 
     *statep = NULL;
 
+    /* apply any batch still open, it's already in the index */
+    r = conversations_batch_end(state);
+    if (r) {
+        syslog(LOG_ERR, "IOERROR: conversations_commit: applying batch for %s: %s",
+               state->path, error_message(r));
+        r = 0;
+    }
+
     /* commit cache, writes to to DB */
     conversations_commitcache(state);
 
@@ -799,7 +939,7 @@ EXPORTED int conversation_store(struct conversations_state *state,
 
     n = dlist_newlist(dl, "SENDER");
     i = 0;
-    for (sender = conv->senders ; sender ; sender = sender->next) {
+    for (sender = conversation_get_senders(conv) ; sender ; sender = sender->next) {
         if (!sender->exists)
             continue;
         /* don't ever store more than 100 senders */
@@ -819,7 +959,7 @@ EXPORTED int conversation_store(struct conversations_state *state,
     dlist_setnum32(dl, "SIZE", conv->size);
 
     n = dlist_newlist(dl, "THREAD");
-    for (thread = conv->thread; thread; thread = thread->next) {
+    for (thread = conversation_get_thread(conv); thread; thread = thread->next) {
         if (!thread->exists)
             continue;
         nn = dlist_newlist(n, "THREAD");
@@ -1089,6 +1229,334 @@ static conv_thread_t *parse_thread(struct dlist *dl)
     return res;
 }
 
+/*
+ * Direct reader for the text form of a B record, as written by
+ * conversation_store().  Every record in the database goes through
+ * here on each load, so fill in the conversation straight from the
+ * buffer rather than building (and freeing) a dlist tree first.
+ * Anything it doesn't understand is left to the dlist parser.
+ */
+struct convreader {
+    const char *p;
+    const char *end;
+};
+
+static int convreader_eat(struct convreader *cr, char c)
+{
+    if (cr->p < cr->end && *cr->p == c) {
+        cr->p++;
+        return 1;
+    }
+    return 0;
+}
+
+/* start of a list; items are separated by single spaces */
+static int convreader_open(struct convreader *cr)
+{
+    convreader_eat(cr, ' ');
+    return convreader_eat(cr, '(') ? 0 : IMAP_MAILBOX_BADFORMAT;
+}
+
+/* returns 1 and consumes the ')' if the current list is done */
+static int convreader_close(struct convreader *cr)
+{
+    convreader_eat(cr, ' ');
+    return convreader_eat(cr, ')');
+}
+
+static int convreader_num(struct convreader *cr, bit64 *nump)
+{
+    convreader_eat(cr, ' ');
+    if (cr->p >= cr->end || !cyrus_isdigit(*cr->p))
+        return IMAP_MAILBOX_BADFORMAT;
+    if (parsenum(cr->p, &cr->p, cr->end - cr->p, nump))
+        return IMAP_MAILBOX_BADFORMAT;
+    return 0;
+}
+
+/* NIL gives a NULL string, everything else is copied into buf */
+static int convreader_string(struct convreader *cr, struct buf *buf,
+                             const char **valp)
+{
+    const char *s;
+    size_t len;
+
+    convreader_eat(cr, ' ');
+    if (cr->p >= cr->end)
+        return IMAP_MAILBOX_BADFORMAT;
+
+    switch (*cr->p) {
+    case '"':
+        s = ++cr->p;
+        while (cr->p < cr->end && *cr->p != '"') {
+            /* never written by prot_printastring, leave it to dlist */
+            if (*cr->p == '\\')
+                return IMAP_MAILBOX_BADFORMAT;
+            cr->p++;
+        }
+        if (cr->p >= cr->end)
+            return IMAP_MAILBOX_BADFORMAT;
+        len = cr->p++ - s;
+        break;
+
+    case '{': {
+        bit64 litlen;
+        cr->p++;
+        if (cr->p >= cr->end ||
+            parsenum(cr->p, &cr->p, cr->end - cr->p, &litlen))
+            return IMAP_MAILBOX_BADFORMAT;
+        convreader_eat(cr, '+');
+        if (!convreader_eat(cr, '}') ||
+            !convreader_eat(cr, '\r') || !convreader_eat(cr, '\n'))
+            return IMAP_MAILBOX_BADFORMAT;
+        if (litlen > (bit64)(cr->end - cr->p))
+            return IMAP_MAILBOX_BADFORMAT;
+        s = cr->p;
+        len = litlen;
+        cr->p += len;
+        break;
+    }
+
+    case '(':
+    case ')':
+        return IMAP_MAILBOX_BADFORMAT;
+
+    default:
+        s = cr->p;
+        while (cr->p < cr->end && *cr->p != ' ' &&
+               *cr->p != '(' && *cr->p != ')')
+            cr->p++;
+        len = cr->p - s;
+        if (len == 3 && !memcmp(s, "NIL", 3)) {
+            *valp = NULL;
+            return 0;
+        }
+        break;
+    }
+
+    buf_setmap(buf, s, len);
+    *valp = buf_cstring(buf);
+    return 0;
+}
+
+/* ((NAME ROUTE MAILBOX DOMAIN LASTSEEN EXISTS)...)
+ * with a NULL conv the section is only checked, not decoded */
+static int convreader_senders(struct convreader *cr, conversation_t *conv)
+{
+    struct buf name = BUF_INITIALIZER;
+    struct buf route = BUF_INITIALIZER;
+    struct buf mailbox = BUF_INITIALIZER;
+    struct buf domain = BUF_INITIALIZER;
+    int r = IMAP_MAILBOX_BADFORMAT;
+
+    if (convreader_open(cr)) goto done;
+    while (!convreader_close(cr)) {
+        const char *n, *rt, *mb, *dom;
+        bit64 lastseen, exists;
+        if (convreader_open(cr)) goto done;
+        if (convreader_string(cr, &name, &n)) goto done;
+        if (convreader_string(cr, &route, &rt)) goto done;
+        if (convreader_string(cr, &mailbox, &mb)) goto done;
+        if (convreader_string(cr, &domain, &dom)) goto done;
+        if (convreader_close(cr)) {
+            /* XXX: remove when cleaned up - handle old-style too */
+            if (conv)
+                conversation_update_sender(conv, n, rt, mb, dom,
+                                           0/*time_t*/, (1<<30)/*exists*/);
+            /* INSANE EXISTS NUMBER MEANS IT NEVER GETS CLEANED UP */
+            continue;
+        }
+        if (convreader_num(cr, &lastseen)) goto done;
+        if (convreader_num(cr, &exists)) goto done;
+        if (!convreader_close(cr)) goto done;
+        if (conv)
+            conversation_update_sender(conv, n, rt, mb, dom, lastseen, exists);
+    }
+    r = 0;
+
+done:
+    buf_free(&name);
+    buf_free(&route);
+    buf_free(&mailbox);
+    buf_free(&domain);
+    return r;
+}
+
+/* ((GUID EXISTS INTERNALDATE MSGID [INREPLYTO])...)
+ * with a NULL threadp the section is only checked, not decoded */
+static int convreader_thread(struct convreader *cr, conv_thread_t **threadp)
+{
+    struct buf guid = BUF_INITIALIZER;
+    conv_thread_t scratch;
+    const char *val;
+    bit64 num;
+    int r = IMAP_MAILBOX_BADFORMAT;
+
+    if (convreader_open(cr)) goto done;
+    while (!convreader_close(cr)) {
+        conv_thread_t *thread = &scratch;
+        if (threadp) {
+            thread = *threadp = xzmalloc(sizeof(conv_thread_t));
+            threadp = &thread->next;
+        }
+        if (convreader_open(cr)) goto done;
+        if (convreader_close(cr)) continue;
+        if (convreader_string(cr, &guid, &val)) goto done;
+        if (val && guid.len == 2*MESSAGE_GUID_SIZE)
+            message_guid_decode(&thread->guid, val);
+        if (convreader_close(cr)) continue;
+        if (convreader_num(cr, &num)) goto done;
+        thread->exists = num;
+        if (convreader_close(cr)) continue;
+        if (convreader_num(cr, &num)) goto done;
+        thread->internaldate = num;
+        if (convreader_close(cr)) continue;
+        if (convreader_num(cr, &num)) goto done;
+        thread->msgid = num;
+        if (convreader_close(cr)) continue;
+        if (convreader_num(cr, &num)) goto done;
+        thread->inreplyto = num;
+        if (!convreader_close(cr)) goto done;
+    }
+    r = 0;
+
+done:
+    buf_free(&guid);
+    return r;
+}
+
+static int conversation_parse_direct(struct conversations_state *state,
+                                     const char *data, size_t datalen,
+                                     conversation_t *conv)
+{
+    struct convreader cr = { data, data + datalen };
+    struct buf subject = BUF_INITIALIZER;
+    const char *val;
+    const char *start;
+    bit64 num;
+    int i;
+    int r = IMAP_MAILBOX_BADFORMAT;
+
+    if (convreader_open(&cr)) goto done;
+
+    /* MODSEQ NUMRECORDS EXISTS UNSEEN */
+    if (convreader_close(&cr)) goto end;
+    if (convreader_num(&cr, &num)) goto done;
+    conv->modseq = num;
+    if (convreader_close(&cr)) goto end;
+    if (convreader_num(&cr, &num)) goto done;
+    conv->num_records = num;
+    if (convreader_close(&cr)) goto end;
+    if (convreader_num(&cr, &num)) goto done;
+    conv->exists = num;
+    if (convreader_close(&cr)) goto end;
+    if (convreader_num(&cr, &num)) goto done;
+    conv->unseen = num;
+
+    /* (COUNTS...) */
+    if (convreader_close(&cr)) goto end;
+    if (convreader_open(&cr)) goto done;
+    for (i = 0; !convreader_close(&cr); i++) {
+        if (convreader_num(&cr, &num)) goto done;
+        if (state->counted_flags && i < state->counted_flags->count)
+            conv->counts[i] = num;
+    }
+
+    /* ((FOLDER MODSEQ NUMRECORDS EXISTS UNSEEN)...) */
+    if (convreader_close(&cr)) goto end;
+    if (convreader_open(&cr)) goto done;
+    while (!convreader_close(&cr)) {
+        conv_folder_t *folder;
+        bit64 vals[5] = { 0, 0, 0, 0, 0 };
+        int nvals;
+        if (convreader_open(&cr)) goto done;
+        for (nvals = 0; !convreader_close(&cr); nvals++) {
+            if (nvals == 5 || convreader_num(&cr, &vals[nvals])) goto done;
+        }
+        if (!nvals) continue;
+        folder = conversation_get_folder(conv, vals[0], 1);
+        if (!folder) goto done;
+        folder->modseq = vals[1];
+        folder->num_records = vals[2];
+        folder->exists = vals[3];
+        folder->unseen = vals[4];
+        folder->prev_exists = folder->exists;
+    }
+
+    /* senders: most loads only want the counts, so just check the
+     * section here and keep a copy of it for conversation_get_senders() */
+    if (convreader_close(&cr)) goto end;
+    start = cr.p;
+    if (convreader_senders(&cr, NULL)) goto done;
+    buf_setmap(&conv->rawsenders, start, cr.p - start);
+
+    /* SUBJECT SIZE */
+    if (convreader_close(&cr)) goto end;
+    if (convreader_string(&cr, &subject, &val)) goto done;
+    conv->subject = xstrdup(val ? val : "");
+    if (convreader_close(&cr)) goto end;
+    if (convreader_num(&cr, &num)) goto done;
+    conv->size = num;
+
+    /* thread: same again, see conversation_get_thread() */
+    if (convreader_close(&cr)) goto end;
+    start = cr.p;
+    if (convreader_thread(&cr, NULL)) goto done;
+    buf_setmap(&conv->rawthread, start, cr.p - start);
+
+    if (!convreader_close(&cr)) goto done;
+
+end:
+    /* nothing may follow the record */
+    r = (cr.p == cr.end) ? 0 : IMAP_MAILBOX_BADFORMAT;
+
+done:
+    buf_free(&subject);
+    return r;
+}
+
+/* Decode the senders section if conversation_parse_direct() left it
+ * undecoded.  The copy was already checked, so this can't fail short
+ * of running out of memory. */
+EXPORTED conv_sender_t *conversation_get_senders(conversation_t *conv)
+{
+    struct buf raw = BUF_INITIALIZER;
+    struct convreader cr;
+    int dirty = conv->dirty;
+
+    if (!buf_len(&conv->rawsenders)) return conv->senders;
+
+    /* update_sender comes back in here, so take the copy off first */
+    buf_move(&raw, &conv->rawsenders);
+    cr.p = buf_base(&raw);
+    cr.end = cr.p + buf_len(&raw);
+    if (convreader_senders(&cr, conv))
+        syslog(LOG_ERR, "conversation_get_senders: failed to decode senders");
+    buf_free(&raw);
+
+    /* decoding what's stored doesn't change anything */
+    conv->dirty = dirty;
+
+    return conv->senders;
+}
+
+EXPORTED conv_thread_t *conversation_get_thread(conversation_t *conv)
+{
+    struct buf raw = BUF_INITIALIZER;
+    struct convreader cr;
+
+    if (!buf_len(&conv->rawthread)) return conv->thread;
+
+    buf_move(&raw, &conv->rawthread);
+    cr.p = buf_base(&raw);
+    cr.end = cr.p + buf_len(&raw);
+    if (convreader_thread(&cr, &conv->thread))
+        syslog(LOG_ERR, "conversation_get_thread: failed to decode thread");
+    buf_free(&raw);
+
+    return conv->thread;
+}
+
 EXPORTED int conversation_parse(struct conversations_state *state,
                        const char *data, size_t datalen,
                        conversation_t **convp)
@@ -1114,6 +1582,13 @@ EXPORTED int conversation_parse(struct conversations_state *state,
 
     if (version != CONVERSATIONS_VERSION) return IMAP_MAILBOX_BADFORMAT;
 
+    conv = conversation_new(state);
+    r = conversation_parse_direct(state, rest, restlen, conv);
+    if (!r) goto done;
+
+    /* something unusual in the record, take the long way round */
+    conversation_free(conv);
+
     r = dlist_parsemap(&dl, 0, 0, rest, restlen);
     if (r) return r;
 
@@ -1198,6 +1673,7 @@ EXPORTED int conversation_parse(struct conversations_state *state,
     n = dlist_getchildn(dl, 9);
     if (n) conv->thread = parse_thread(n);
 
+done:
     conv->prev_unseen = conv->unseen;
 
     dlist_free(&dl);
@@ -1408,7 +1884,7 @@ static void conversation_update_thread(conversation_t *conv,
 {
     conv_thread_t *thread, *parent, **nextp = &conv->thread;
 
-    for (thread = conv->thread; thread; thread = thread->next) {
+    for (thread = conversation_get_thread(conv); thread; thread = thread->next) {
         /* does it already exist? */
         if (message_guid_equal(guid, &thread->guid))
             break;
@@ -1485,7 +1961,7 @@ EXPORTED void conversation_update_sender(conversation_t *conv,
     if (!mailbox || !domain) return;
 
     /* always re-stitch the found record, it's just simpler */
-    for (sender = conv->senders; sender; sender = sender->next) {
+    for (sender = conversation_get_senders(conv); sender; sender = sender->next) {
         if (!sender_cmp(sender, mailbox, domain))
             break;
         nextp = &sender->next;
@@ -1876,6 +2352,21 @@ EXPORTED int conversations_update_record(struct conversations_state *cstate,
             if (r) return r;
             return conversations_update_record(cstate, mailbox, NULL, new, 0);
         }
+
+        /* only the flags changed: nothing to do but sum the counts if
+         * we're batching.  Sender data only changes when a record is
+         * added or removed, but the thread entry is rewritten on every
+         * update and only drafts keep their inreplyto, so a \Draft
+         * change has to take the long way round */
+        if (cstate->batch_folder >= 0 && new->cid &&
+            !strcmp(mailbox->name, strarray_nth(cstate->folder_names,
+                                                cstate->batch_folder)) &&
+            old->size == new->size &&
+            (old->system_flags & FLAG_EXPUNGED) == (new->system_flags & FLAG_EXPUNGED) &&
+            ((old->system_flags ^ new->system_flags) & FLAG_DRAFT) == 0) {
+            conversations_batch_record(cstate, mailbox, old, new);
+            return 0;
+        }
     }
 
     if (new && !old && allowrenumber) {
@@ -1910,17 +2401,12 @@ EXPORTED int conversations_update_record(struct conversations_state *cstate,
     if (cstate->counted_flags)
         delta_counts = xzmalloc(sizeof(int) * cstate->counted_flags->count);
 
-    /* IRIS-2534: check if it's the trash folder - XXX - should be separate
-     * conversation root or similar more useful method in future */
-    mbname_t *mbname = mbname_from_intname(mailbox->name);
-    if (!mbname)
-        return IMAP_MAILBOX_BADNAME;
-
-    const strarray_t *boxes = mbname_boxes(mbname);
-    if (strarray_size(boxes) == 1 && !strcmpsafe(strarray_nth(boxes, 0), "Trash"))
-        is_trash = 1;
-
-    mbname_free(&mbname);
+    r = conversations_is_trash(mailbox->name, &is_trash);
+    if (r) {
+        conversation_free(conv);
+        free(delta_counts);
+        return r;
+    }
 
     /* calculate the changes */
     if (old) {
@@ -2109,6 +2595,9 @@ EXPORTED void conversation_free(conversation_t *conv)
         free(sender);
     }
 
+    buf_free(&conv->rawsenders);
+    buf_free(&conv->rawthread);
+
     free(conv->subject);
     free(conv->counts);
 
@@ -2292,6 +2781,7 @@ static int zero_b_cb(void *rock,
     }
 
     /* just zero out senders */
+    buf_free(&conv->rawsenders);
     while ((sender = conv->senders)) {
         conv->senders = sender->next;
         free(sender->name);
@@ -2301,6 +2791,7 @@ static int zero_b_cb(void *rock,
         free(sender);
     }
 
+    buf_free(&conv->rawthread);
     while ((thread = conv->thread)) {
         conv->thread = thread->next;
         free(thread);
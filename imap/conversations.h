@@ -71,6 +71,9 @@ struct conversations_state {
     strarray_t *folder_names;
     hash_table folderstatus;
     char *path;
+    int batch_folder;           /* -1 unless batching, see below */
+    int batch_is_trash;
+    hashu64_table batch;        /* cid => struct conv_batched */
 };
 
 struct conversations_open {
@@ -145,6 +148,9 @@ struct conversation {
     conv_thread_t   *thread;
     char            *subject;
     int             dirty;
+    /* undecoded sections from the parser, use the getters below */
+    struct buf      rawsenders;
+    struct buf      rawthread;
 };
 
 #include "mailbox.h"
@@ -232,6 +238,16 @@ extern int conversations_update_record(struct conversations_state *cstate,
                                        struct index_record *new,
                                        int allowrenumber);
 
+/* Batch flag-only updates to the records of one mailbox.  Between
+ * begin and end, conversations_update_record() just sums the changes
+ * in unseen and counted flag counts per conversation, and
+ * conversations_batch_end() applies them with one load and save of
+ * each conversation touched.  Records whose CID, size or expunged
+ * state change are still applied immediately. */
+extern void conversations_batch_begin(struct conversations_state *state,
+                                      struct mailbox *mailbox);
+extern int conversations_batch_end(struct conversations_state *state);
+
 extern void conversation_update(struct conversations_state *state,
                                 conversation_t *conv,
                                 const char *mboxname,
@@ -255,6 +271,10 @@ extern void conversation_update_sender(conversation_t *conv,
                                        time_t lastseen,
                                        int delta_exists);
 
+/* senders and thread are decoded on first use after a load */
+extern conv_sender_t *conversation_get_senders(conversation_t *conv);
+extern conv_thread_t *conversation_get_thread(conversation_t *conv);
+
 extern int conversations_prune(struct conversations_state *state,
                                time_t thresh, unsigned int *,
                                unsigned int *);
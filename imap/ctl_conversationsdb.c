@@ -543,7 +543,7 @@ static int fix_modseqs(struct conversations_state *a,
 
             /* senders are timestamped, and the timestamp might be for a
              * deleted message! */
-            for (sendera = conva->senders; sendera; sendera = sendera->next) {
+            for (sendera = conversation_get_senders(conva); sendera; sendera = sendera->next) {
                 /* always update!  The delta logic will ensure we don't add
                  * the record if it's not already at least present in the
                  * other conversation */
@@ -82,9 +82,25 @@
     " comp_flags INTEGER,"                                              \
     " sched_tag TEXT,"                                                  \
     " alive INTEGER,"                                                   \
+    " occurs_start INTEGER,"                                            \
+    " occurs_horizon INTEGER,"                                          \
     " UNIQUE( mailbox, resource ) );"                                   \
     "CREATE INDEX IF NOT EXISTS idx_ical_uid ON ical_objs ( ical_uid );"
 
+#define CMD_CREATE_OCC                                                  \
+    "CREATE TABLE IF NOT EXISTS ical_occurs ("                          \
+    " rowid INTEGER PRIMARY KEY,"                                       \
+    " objid INTEGER,"                                                   \
+    " recurid TEXT,"                                                    \
+    " dtstart TEXT,"                                                    \
+    " dtend TEXT,"                                                      \
+    " utc_start INTEGER NOT NULL," /* for range queries */              \
+    " utc_end INTEGER NOT NULL,"                                        \
+    " transp INTEGER NOT NULL DEFAULT 0,"                               \
+    " status INTEGER NOT NULL DEFAULT 0,"                               \
+    " FOREIGN KEY (objid) REFERENCES ical_objs (rowid) ON DELETE CASCADE );" \
+    "CREATE INDEX IF NOT EXISTS idx_ical_occurs ON ical_occurs ( objid, utc_start );"
+
 #define CMD_CREATE_CARD                                                 \
     "CREATE TABLE IF NOT EXISTS vcard_objs ("                           \
     " rowid INTEGER PRIMARY KEY,"                                       \
@@ -150,7 +166,7 @@
 
 
 #define CMD_CREATE CMD_CREATE_CAL CMD_CREATE_CARD CMD_CREATE_EM CMD_CREATE_GR \
-                   CMD_CREATE_OBJS
+                   CMD_CREATE_OBJS CMD_CREATE_OCC
 
 /* leaves these unused columns around, but that's life.  A dav_reconstruct
  * will fix them */
@@ -176,16 +192,25 @@
 
 #define CMD_DBUPGRADEv6 CMD_CREATE_OBJS
 
+/* existing resources have no indexed occurrences until they are
+ * rewritten (or a dav_reconstruct is run) */
+#define CMD_DBUPGRADEv7                                         \
+    "ALTER TABLE ical_objs ADD COLUMN occurs_start INTEGER;"    \
+    "ALTER TABLE ical_objs ADD COLUMN occurs_horizon INTEGER;"  \
+    "UPDATE ical_objs SET occurs_start = 0, occurs_horizon = 0;" \
+    CMD_CREATE_OCC
+
 struct sqldb_upgrade davdb_upgrade[] = {
   { 2, CMD_DBUPGRADEv2, NULL },
   { 3, CMD_DBUPGRADEv3, NULL },
   { 4, CMD_DBUPGRADEv4, NULL },
   { 5, CMD_DBUPGRADEv5, NULL },
   { 6, CMD_DBUPGRADEv6, NULL },
+  { 7, CMD_DBUPGRADEv7, NULL },
   { 0, NULL, NULL }
 };
 
-#define DB_VERSION 6
+#define DB_VERSION 7
 
 static int in_reconstruct = 0;
 
@@ -0,0 +1,179 @@
+/* dav_respcache.c -- per-process cache of serialized DAV <response> elements
+ *
+ * Copyright (c) 1994-2017 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+/*
+ * Per-process cache of serialized <response> elements for resources.
+ *
+ * When a multistatus is being streamed, the <response> for a resource
+ * only depends on the resource (index record and DAV lock state), its
+ * collection (ACL), the authenticated user, the properties and
+ * namespaces of the request, and the request inputs added by
+ * dav_respcache_request_key().  All of these are folded into the key
+ * (see respcache_key() in http_dav.c) so that a repeated PROPFIND or
+ * REPORT of an unchanged resource can be answered by splicing the
+ * cached bytes into the output without running any of the property
+ * callbacks.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "dav_respcache.h"
+#include "hash.h"
+#include "spool.h"
+#include "util.h"
+#include "xmalloc.h"
+
+#define RESPCACHE_MAXBYTES  (8 * 1024 * 1024)
+
+/* Request headers which change the content of properties:
+ * CalDAV-Timezones decides whether calendar-data carries VTIMEZONEs.
+ * (Prefer and Brief are already in the key as the propfind flags.) */
+static const char *respcache_hdrs[] = {
+    "CalDAV-Timezones",
+    NULL
+};
+
+struct respcache_entry {
+    char *key;
+    struct buf frag;
+    struct respcache_entry *prev;       /* LRU list, most recent first */
+    struct respcache_entry *next;
+};
+
+static struct {
+    hash_table table;
+    struct respcache_entry *head;
+    struct respcache_entry *tail;
+    size_t bytes;
+} respcache = { HASH_TABLE_INITIALIZER, NULL, NULL, 0 };
+
+static void respcache_unlink(struct respcache_entry *entry)
+{
+    if (entry->prev) entry->prev->next = entry->next;
+    else respcache.head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else respcache.tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void respcache_link(struct respcache_entry *entry)
+{
+    entry->next = respcache.head;
+    if (respcache.head) respcache.head->prev = entry;
+    respcache.head = entry;
+    if (!respcache.tail) respcache.tail = entry;
+}
+
+static void respcache_free(struct respcache_entry *entry)
+{
+    respcache_unlink(entry);
+    hash_del(entry->key, &respcache.table);
+    respcache.bytes -= strlen(entry->key) + buf_len(&entry->frag);
+    buf_free(&entry->frag);
+    free(entry->key);
+    free(entry);
+}
+
+EXPORTED void dav_respcache_request_key(struct buf *key, unsigned meth,
+                                        hdrcache_t req_hdrs)
+{
+    const char **hdr;
+    int i;
+
+    /* e.g. calendar-data is forbidden in a PROPFIND but not a REPORT */
+    buf_printf(key, "\x1f%u", meth);
+
+    for (i = 0; respcache_hdrs[i]; i++) {
+        hdr = req_hdrs ? spool_getheader(req_hdrs, respcache_hdrs[i]) : NULL;
+        buf_printf(key, "\x1f%s", hdr ? hdr[0] : "");
+    }
+}
+
+EXPORTED const struct buf *dav_respcache_lookup(const char *key)
+{
+    struct respcache_entry *entry;
+
+    if (!respcache.table.size) return NULL;
+
+    entry = hash_lookup(key, &respcache.table);
+    if (!entry) return NULL;
+
+    respcache_unlink(entry);
+    respcache_link(entry);
+
+    return &entry->frag;
+}
+
+EXPORTED void dav_respcache_store(const char *key,
+                                  const char *frag, size_t len)
+{
+    struct respcache_entry *entry;
+
+    /* Don't let one huge resource flush everything else */
+    if (len > RESPCACHE_MAXBYTES / 16) return;
+
+    if (!respcache.table.size) {
+        construct_hash_table(&respcache.table, 4096, 0);
+    }
+    else if (hash_lookup(key, &respcache.table)) return;
+
+    entry = xzmalloc(sizeof(struct respcache_entry));
+    entry->key = xstrdup(key);
+    buf_setmap(&entry->frag, frag, len);
+    hash_insert(entry->key, entry, &respcache.table);
+    respcache_link(entry);
+    respcache.bytes += strlen(key) + len;
+
+    /* Evict least recently used entries */
+    while (respcache.bytes > RESPCACHE_MAXBYTES && respcache.tail != entry) {
+        respcache_free(respcache.tail);
+    }
+}
+
+EXPORTED void dav_respcache_reset(void)
+{
+    while (respcache.head) respcache_free(respcache.head);
+    if (respcache.table.size) free_hash_table(&respcache.table, NULL);
+}
@@ -70,8 +70,11 @@
 #include "global.h"
 #include "libconfig.h"
 #include "libcyr_cfg.h"
+#include "mailbox.h"
 #include "mboxlist.h"
 #include "mutex.h"
+#include "proc.h"
+#include "prometheus.h"
 #include "prot.h" /* for PROT_BUFSIZE */
 #include "strarray.h"
 #include "userdeny.h"
@@ -179,6 +182,105 @@ static void cyrus_modules_done()
     }
 }
 
+/* log waits for locks longer than this, along with who held the lock */
+static double sample_locks_longer_than = 0.0;
+
+/* Lock waits are far too frequent to pay for a locked write to the
+ * prometheus stats file each, so they're bucketed in memory and written
+ * out every LOCKWAIT_FLUSH_INTERVAL seconds, and when we exit. */
+#define LOCKWAIT_FLUSH_INTERVAL 10
+static struct prom_histogram_batch lockwait_batch[] = {
+    PROM_HISTOGRAM_BATCH_INITIALIZER(CYRUS_LOCK_WAIT_SECONDS_CLASS_INDEX),
+    PROM_HISTOGRAM_BATCH_INITIALIZER(CYRUS_LOCK_WAIT_SECONDS_CLASS_NAMELOCK),
+    PROM_HISTOGRAM_BATCH_INITIALIZER(CYRUS_LOCK_WAIT_SECONDS_CLASS_DATABASE),
+};
+static time_t lockwait_flushed = 0;
+/* set at init when lock waits are being recorded, so that the stats
+ * files' own locks can be left out */
+static const char *lockwait_statsdir = NULL;
+
+static void global_lock_wait_flush(void)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(lockwait_batch) / sizeof(lockwait_batch[0]); i++)
+        prometheus_batch_flush(&lockwait_batch[i]);
+    lockwait_flushed = time(NULL);
+}
+
+static int lock_holder_cb(pid_t pid __attribute__((unused)),
+                          const char *servicename,
+                          const char *clienthost __attribute__((unused)),
+                          const char *userid, const char *mailbox,
+                          const char *cmd, void *rock)
+{
+    struct buf *buf = (struct buf *) rock;
+
+    buf_printf(buf, " holder_service=<%s> holder_userid=<%s>"
+                    " holder_mailbox=<%s> holder_command=<%s>",
+               servicename, userid ? userid : "",
+               mailbox ? mailbox : "", cmd ? cmd : "");
+
+    return 0;
+}
+
+/*
+ * Account for the time we spent waiting for a lock, by class of lock.
+ * The class is deduced from the filename: mailbox index locks end in
+ * FNAME_INDEX, name locks in ".lock", and anything else is a database.
+ */
+static void global_lock_wait(const char *filename, int exclusive,
+                             double waited, pid_t holder)
+{
+    static int inobserver = 0;
+    struct prom_histogram_batch *batch;
+    size_t len;
+
+    /* flushing the observations takes a lock of its own */
+    if (inobserver) return;
+    inobserver = 1;
+
+    if (lockwait_statsdir) {
+        if (!strncmp(filename, lockwait_statsdir, strlen(lockwait_statsdir)))
+            goto done;
+
+        len = strlen(filename);
+        if (len >= strlen(FNAME_INDEX)
+            && !strcmp(filename + len - strlen(FNAME_INDEX), FNAME_INDEX)) {
+            batch = &lockwait_batch[0];
+        }
+        else if (len >= 5 && !strcmp(filename + len - 5, ".lock")) {
+            batch = &lockwait_batch[1];
+        }
+        else {
+            batch = &lockwait_batch[2];
+        }
+
+        prometheus_batch_observe(batch, waited);
+        if (time(NULL) - lockwait_flushed >= LOCKWAIT_FLUSH_INTERVAL)
+            global_lock_wait_flush();
+    }
+
+    if (sample_locks_longer_than && waited >= sample_locks_longer_than) {
+        struct buf buf = BUF_INITIALIZER;
+
+        buf_printf(&buf, "lockwait: sessionid=<%s> file=<%s> type=<%s>"
+                         " waited=<%f> holder_pid=<%d>",
+                   session_id(), filename,
+                   exclusive ? "exclusive" : "shared",
+                   waited, (int) holder);
+
+        /* the holder may have moved on by now, but this is only a sample */
+        if (holder) proc_lookup(holder, lock_holder_cb, &buf);
+
+        syslog(LOG_NOTICE, "%s", buf_cstring(&buf));
+        buf_free(&buf);
+    }
+
+done:
+    inobserver = 0;
+}
+
 /* Called before a cyrus application starts (but after command line parameters
  * are read) */
 EXPORTED int cyrus_init(const char *alt_config, const char *ident, unsigned flags, int config_need_data)
@@ -381,6 +483,20 @@ EXPORTED int cyrus_init(const char *alt_config, const char *ident, unsigned flag
         debug_locks_longer_than = atof(locktime);
     }
 
+    /* lock wait accounting */
+    locktime = config_getstring(IMAPOPT_LOCK_SAMPLETIME);
+    if (locktime) {
+        sample_locks_longer_than = atof(locktime);
+    }
+    if (config_getswitch(IMAPOPT_PROMETHEUS_ENABLED)) {
+        /* may fatal() on a bad path, so not from inside a lock */
+        lockwait_statsdir = prometheus_stats_dir();
+        lockwait_flushed = time(NULL);
+    }
+    if (sample_locks_longer_than || lockwait_statsdir) {
+        lock_wait_observer = global_lock_wait;
+    }
+
     return 0;
 }
 
@@ -760,6 +876,12 @@ EXPORTED int mysasl_proxy_policy(sasl_conn_t *conn,
 /* call before a cyrus application exits */
 EXPORTED void cyrus_done(void)
 {
+    lock_wait_observer = NULL;
+    if (lockwait_statsdir) {
+        /* before prometheus_done() gets to the stats file */
+        global_lock_wait_flush();
+        lockwait_statsdir = NULL;
+    }
     cyrus_modules_done();
     if (cyrus_init_run != RUNNING)
         return;
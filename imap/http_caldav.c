@@ -4803,6 +4803,18 @@ static void in_range(icalcomponent *comp __attribute__((unused)),
     *pass = 1;
 }
 
+/* caldav_foreach_occurrence() callback to flag an overlapping occurrence */
+static int occurrence_in_range(void *rock,
+                               struct caldav_occurrence *occ
+                               __attribute__((unused)))
+{
+    int *pass = (int *) rock;
+
+    *pass = 1;
+
+    return 1;  /* no need to look any further */
+}
+
 static int apply_comp_timerange(struct comp_filter *compfilter,
                                 icalcomponent *comp, struct caldav_data *cdata,
                                 struct propfind_ctx *fctx)
@@ -4835,6 +4847,26 @@ static int apply_comp_timerange(struct comp_filter *compfilter,
                 return 1;
             }
 
+            if (!comp && fctx->davdb &&
+                caldav_occurrences_indexed(cdata,
+                                           icaltime_as_timet_with_zone(range->start,
+                                                                       utc_zone),
+                                           icaltime_as_timet_with_zone(range->end,
+                                                                       utc_zone))) {
+                /* Look for an indexed occurrence that overlaps range */
+                if (!caldav_foreach_occurrence(fctx->davdb, cdata->dav.rowid,
+                                               icaltime_as_timet_with_zone(range->start,
+                                                                           utc_zone),
+                                               icaltime_as_timet_with_zone(range->end,
+                                                                           utc_zone),
+                                               &occurrence_in_range, &pass) ||
+                    pass) {
+                    return pass;
+                }
+
+                /* Index lookup failed - expand the iCal data instead */
+            }
+
             /* Load message containing the resource and parse iCal data */
             if (!comp) {
                 if (!fctx->msg_buf.len) {
@@ -4923,6 +4955,33 @@ static int apply_compfilter(struct comp_filter *compfilter, icalcomponent *ical,
     return pass;
 }
 
+/* Check if every time-range in a filter which doesn't otherwise need
+ * the iCalendar data can be tested against the indexed occurrences
+ * of the current (recurring) resource.
+ */
+static int occurrences_cover_calfilter(struct calquery_filter *calfilter,
+                                       struct caldav_data *cdata,
+                                       struct propfind_ctx *fctx)
+{
+    struct comp_filter *compfilter;
+
+    if (!fctx->davdb || !cdata->occurs_horizon) return 0;
+
+    for (compfilter = calfilter->comp->comp; compfilter;
+         compfilter = compfilter->next) {
+        if (compfilter->range &&
+            !caldav_occurrences_indexed(cdata,
+                                        icaltime_as_timet_with_zone(compfilter->range->start,
+                                                                    utc_zone),
+                                        icaltime_as_timet_with_zone(compfilter->range->end,
+                                                                    utc_zone))) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
 /* See if the current resource matches the specified filter.
  * Returns 1 if match, 0 otherwise.
  */
@@ -4944,7 +5003,9 @@ static int apply_calfilter(struct propfind_ctx *fctx, void *data)
         }
     }
 
-    if ((calfilter->flags & PARSE_ICAL) || cdata->comp_flags.recurring) {
+    if ((calfilter->flags & PARSE_ICAL) ||
+        (cdata->comp_flags.recurring &&
+         !occurrences_cover_calfilter(calfilter, cdata, fctx))) {
         /* Load message containing the resource and parse iCal data */
         if (!ical) {
             if (!fctx->msg_buf.len)
@@ -6904,6 +6965,30 @@ static void expand_occurrences(icalcomponent *ical,
 }
 
 
+/* caldav_foreach_occurrence() callback to add an indexed occurrence
+   of a recurring event to the busytime array */
+static int add_freebusy_occurrence(void *rock, struct caldav_occurrence *occ)
+{
+    struct freebusy_filter *fbfilter = (struct freebusy_filter *) rock;
+    struct icaltimetype recurid, start, end;
+    icalparameter_fbtype fbtype;
+
+    /* Don't include transparent or canceled occurrences in freebusy */
+    if (occ->transp || occ->status == CAL_STATUS_CANCELED) return 0;
+
+    recurid = icaltime_from_string(occ->recurid);
+    start = icaltime_from_string(occ->dtstart);
+    end = icaltime_from_string(occ->dtend);
+
+    fbtype = (occ->status == CAL_STATUS_TENTATIVE) ?
+        ICAL_FBTYPE_BUSYTENTATIVE : ICAL_FBTYPE_BUSY;
+
+    add_freebusy(&recurid, &start, &end, fbtype, fbfilter);
+
+    return 0;
+}
+
+
 /* Append a new vavailability period to the vavail array */
 static void
 add_vavailability(struct vavailability_array *vavail, icalcomponent *ical)
@@ -6982,6 +7067,30 @@ static int busytime_by_resource(void *rock, void *data)
         return 0;
     }
 
+    if (cdata->comp_flags.recurring && fctx->davdb &&
+        cdata->comp_type == CAL_COMP_VEVENT &&
+        caldav_occurrences_indexed(cdata,
+                                   icaltime_as_timet_with_zone(fbfilter->start,
+                                                               utc_zone),
+                                   icaltime_as_timet_with_zone(fbfilter->end,
+                                                               utc_zone))) {
+        /* Recurring event with its occurrences indexed across the range */
+        unsigned len = fbfilter->freebusy.len;
+
+        if (!caldav_foreach_occurrence(fctx->davdb, cdata->dav.rowid,
+                                       icaltime_as_timet_with_zone(fbfilter->start,
+                                                                   utc_zone),
+                                       icaltime_as_timet_with_zone(fbfilter->end,
+                                                                   utc_zone),
+                                       &add_freebusy_occurrence, fbfilter)) {
+            return 0;
+        }
+
+        /* Index lookup failed - drop any busytime it added
+           and expand the iCal data instead */
+        fbfilter->freebusy.len = len;
+    }
+
     if (cdata->comp_flags.recurring ||
         cdata->comp_type == CAL_COMP_VAVAILABILITY) {
         /* Need to mmap() and parse iCalendar object */
@@ -67,6 +67,7 @@
 #include "acl.h"
 #include "append.h"
 #include "caldav_db.h"
+#include "dav_respcache.h"
 #include "dlist.h"
 #include "exitcodes.h"
 #include "global.h"
@@ -1447,17 +1448,112 @@ struct allprop_rock {
     struct propstat *propstat;
 };
 
+static int respcache_key(struct propfind_ctx *fctx, struct buf *key)
+{
+    struct dav_data *ddata = (struct dav_data *) fctx->data;
+    struct propfind_entry_list *e;
+    xmlBufferPtr propbuf = NULL;
+    xmlNsPtr nsDef;
+
+    if (!(fctx->txn->flags.te & TE_CHUNKED)) return 0;
+
+    /* Only cache plain resources for unfiltered requests */
+    if (!fctx->req_tgt->resource || !fctx->record || !fctx->mailbox ||
+        fctx->filter_crit || fctx->mode == PROPFIND_EXPAND) {
+        return 0;
+    }
+
+    /* lockdiscovery of a locked resource changes with time */
+    if (ddata && ddata->lock_token && ddata->lock_expire > time(NULL)) {
+        return 0;
+    }
+
+    buf_printf(key, "%s\x1f%d\x1f%s\x1f%s\x1f%s\x1f%s\x1f%u\x1f"
+               MODSEQ_FMT "\x1f%s\x1f%u\x1f%u",
+               fctx->userid ? fctx->userid : "", fctx->userisadmin,
+               fctx->mailbox->name, fctx->mailbox->uniqueid,
+               fctx->mailbox->acl ? fctx->mailbox->acl : "",
+               fctx->req_tgt->path, fctx->record->uid, fctx->record->modseq,
+               (ddata && ddata->lock_token) ? ddata->lock_token : "",
+               fctx->mode, fctx->prefer);
+
+    /* Method and request headers which change property values */
+    dav_respcache_request_key(key, fctx->txn->meth, fctx->txn->req_hdrs);
+
+    /* Namespace prefixes used in the serialized response */
+    for (nsDef = fctx->root->nsDef; nsDef; nsDef = nsDef->next) {
+        buf_printf(key, "\x1f%s=%s",
+                   nsDef->prefix ? (const char *) nsDef->prefix : "",
+                   (const char *) nsDef->href);
+    }
+
+    /* Requested properties, including any parameters (e.g. expand) */
+    for (e = fctx->elist; e; e = e->next) {
+        buf_printf(key, "\x1f{%s}%s",
+                   e->ns ? (const char *) e->ns->href : "",
+                   (const char *) e->name);
+
+        if (e->prop && (e->prop->properties || e->prop->children)) {
+            if (!propbuf) propbuf = xmlBufferCreate();
+            else xmlBufferEmpty(propbuf);
+            xmlNodeDump(propbuf, e->prop->doc, e->prop, 0, 0);
+            buf_appendmap(key, (const char *) xmlBufferContent(propbuf),
+                          xmlBufferLength(propbuf));
+        }
+    }
+
+    if (propbuf) xmlBufferFree(propbuf);
+
+    return 1;
+}
+
+/* Append a serialized <response> element to the chunked output */
+static void xml_add_fragment(struct propfind_ctx *fctx,
+                             const char *frag, size_t len)
+{
+    if (!fctx->xmlbuf) fctx->xmlbuf = xmlBufferCreate();
+
+    xmlBufferAdd(fctx->xmlbuf, BAD_CAST frag, len);
+
+    /* Only output the xmlBuffer every PROT_BUFSIZE bytes */
+    if (xmlBufferLength(fctx->xmlbuf) > PROT_BUFSIZE) {
+        write_body(0, fctx->txn, (char *) xmlBufferContent(fctx->xmlbuf),
+                   xmlBufferLength(fctx->xmlbuf));
+        xmlBufferEmpty(fctx->xmlbuf);
+    }
+}
+
 /* Add a response tree to 'root' for the specified href and
    either error code or property list */
 int xml_add_response(struct propfind_ctx *fctx, long code, unsigned precond,
                      const char *desc, const char *location)
 {
+    struct buf cachekey = BUF_INITIALIZER;
     xmlNodePtr resp;
+    xmlNsPtr lastns = NULL;
+    int cacheable = 0;
+
+    if (!code && respcache_key(fctx, &cachekey)) {
+        const struct buf *frag = dav_respcache_lookup(buf_cstring(&cachekey));
+
+        if (frag) {
+            /* Splice cached <response> element into our output */
+            xml_add_fragment(fctx, buf_base(frag), buf_len(frag));
+            buf_free(&cachekey);
+            fctx->record = NULL;
+            return 0;
+        }
+
+        for (lastns = fctx->root->nsDef; lastns && lastns->next;
+             lastns = lastns->next);
+        cacheable = 1;
+    }
 
     resp = xmlNewChild(fctx->root, fctx->ns[NS_DAV], BAD_CAST "response", NULL);
     if (!resp) {
         fctx->txn->error.desc = "Unable to add response XML element";
         *fctx->ret = HTTP_SERVER_ERROR;
+        buf_free(&cachekey);
         return HTTP_SERVER_ERROR;
     }
     xml_add_href(resp, NULL, fctx->req_tgt->path);
@@ -1567,6 +1663,9 @@ int xml_add_response(struct propfind_ctx *fctx, long code, unsigned precond,
                                  allprop_cb, &arock, /*flags*/0);
         }
 
+        /* Don't cache transient failures */
+        if (propstat[PROPSTAT_ERROR].root) cacheable = 0;
+
         /* Check if we have any propstat elements */
         for (i = 0; i < NUM_PROPSTAT && !propstat[i].root; i++);
         if (i == NUM_PROPSTAT) {
@@ -1595,7 +1694,31 @@ int xml_add_response(struct propfind_ctx *fctx, long code, unsigned precond,
 
     fctx->record = NULL;
 
-    if (fctx->txn->flags.te & TE_CHUNKED) {
+    if (cacheable) {
+        /* Don't cache if a callback had to declare a new namespace */
+        xmlNsPtr ns;
+
+        for (ns = fctx->root->nsDef; ns && ns->next; ns = ns->next);
+        if (ns != lastns) cacheable = 0;
+    }
+
+    if (cacheable) {
+        /* Serialize <response> element on its own so that we can cache it */
+        xmlBufferPtr frag = NULL;
+
+        xml_partial_response(NULL, fctx->root->doc, resp, 1, &frag);
+        dav_respcache_store(buf_cstring(&cachekey),
+                        (const char *) xmlBufferContent(frag),
+                        xmlBufferLength(frag));
+        xml_add_fragment(fctx, (const char *) xmlBufferContent(frag),
+                         xmlBufferLength(frag));
+        xmlBufferFree(frag);
+
+        /* Remove <response> element from root (no need to keep in memory) */
+        xmlReplaceNode(resp, NULL);
+        xmlFreeNode(resp);
+    }
+    else if (fctx->txn->flags.te & TE_CHUNKED) {
         /* Add <response> element for this resource to output buffer.
            Only output the xmlBuffer every PROT_BUFSIZE bytes */
         xml_partial_response((xmlBufferLength(fctx->xmlbuf) > PROT_BUFSIZE) ?
@@ -1607,6 +1730,8 @@ int xml_add_response(struct propfind_ctx *fctx, long code, unsigned precond,
         xmlFreeNode(resp);
     }
 
+    buf_free(&cachekey);
+
     return 0;
 }
 
@@ -8093,13 +8218,30 @@ static int report_prin_prop_search(struct transaction_t *txn,
         goto done;
     }
 
+    /* Setup for chunked response - the search can match every user */
+    txn->flags.te |= TE_CHUNKED;
+
+    /* Begin XML response */
+    xml_response(HTTP_MULTI_STATUS, txn, fctx->root->doc);
+
     /* Only search DAV:principal-collection-set */
     if (apply_prin_set || !fctx->req_tgt->userid) {
         /* XXX  Do LDAP/SQL lookup of CN/email-address(es) here */
 
-        ret = mboxlist_alluser(principal_search, fctx);
+        int r = mboxlist_alluser(principal_search, fctx);
+        if (r) {
+            syslog(LOG_ERR, "principal-property-search failed: %s",
+                   error_message(r));
+        }
     }
 
+    /* End XML response */
+    xml_partial_response(txn, fctx->root->doc, NULL /* end */, 0, &fctx->xmlbuf);
+    xmlBufferFree(fctx->xmlbuf);
+
+    /* End of output */
+    write_body(0, txn, NULL, 0);
+
   done:
     for (search_crit = fctx->filter_crit; search_crit; search_crit = next) {
         next = search_crit->next;
@@ -8109,7 +8251,7 @@ static int report_prin_prop_search(struct transaction_t *txn,
         free(search_crit);
     }
 
-    return (ret ? ret : HTTP_MULTI_STATUS);
+    return ret;
 }
 
 
@@ -308,6 +308,7 @@ static int frame_recv_cb(nghttp2_session *session,
             if (ret) {
                 txn->req_body.flags |= BODY_DISCARD;
                 error_response(ret, txn);
+                transaction_done(txn);
                 break;
             }
 
@@ -346,6 +347,9 @@ static int frame_recv_cb(nghttp2_session *session,
         /* Handle errors (success responses handled by method functions) */
         if (ret) error_response(ret, txn);
 
+        /* The whole response has been submitted by now */
+        transaction_done(txn);
+
         if (txn->flags.conn & CONN_CLOSE) {
             int32_t stream_id =
                 nghttp2_session_get_last_proc_stream_id(ctx->session);
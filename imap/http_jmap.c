@@ -56,6 +56,7 @@
 #include "append.h"
 #include "cyrusdb.h"
 #include "hash.h"
+#include "hashmap.h"
 #include "httpd.h"
 #include "http_dav.h"
 #include "http_proxy.h"
@@ -102,11 +103,11 @@ static int jmap_blob_copy(jmap_req_t *req);
 
 static int myrights(struct auth_state *authstate,
                     const mbentry_t *mbentry,
-                    hash_table *mboxrights);
+                    struct hashmap *mboxrights);
 
 static int myrights_byname(struct auth_state *authstate,
                            const char *mboxname,
-                           hash_table *mboxrights);
+                           struct hashmap *mboxrights);
 
 /* Namespace for JMAP */
 struct namespace_t namespace_jmap = {
@@ -218,7 +219,7 @@ struct mymblist_rock {
     mboxlist_cb *proc;
     void *rock;
     struct auth_state *authstate;
-    hash_table *mboxrights;
+    struct hashmap *mboxrights;
     int all;
 };
 
@@ -240,7 +241,7 @@ static int mymblist_cb(const mbentry_t *mbentry, void *rock)
 static int mymblist(const char *userid,
                     const char *accountid,
                     struct auth_state *authstate,
-                    hash_table *mboxrights,
+                    struct hashmap *mboxrights,
                     mboxlist_cb *proc,
                     void *rock,
                     int all)
@@ -655,6 +656,51 @@ static int validate_request(struct transaction_t *txn, json_t *req)
     return 0;
 }
 
+/*
+ * Streaming response output.
+ *
+ * Method responses are serialised straight into an output buffer which
+ * is handed to write_body() whenever it grows past JMAP_STREAM_CHUNK.
+ * The first such write switches the response to chunked transfer
+ * (or HTTP/2 DATA frames) and sends the headers; small responses that
+ * never reach the threshold go out in one piece with a Content-Length.
+ */
+#define JMAP_STREAM_CHUNK  (64 * 1024)
+
+struct jmap_stream {
+    struct transaction_t *txn;
+    long code;            /* HTTP_OK until the headers have been sent */
+    struct buf buf;
+};
+
+static int jmap_stream_cb(const char *buffer, size_t size, void *data)
+{
+    struct jmap_stream *stream = (struct jmap_stream *) data;
+
+    buf_appendmap(&stream->buf, buffer, size);
+
+    if (buf_len(&stream->buf) >= JMAP_STREAM_CHUNK) {
+        if (stream->code) stream->txn->flags.te |= TE_CHUNKED;
+        write_body(stream->code, stream->txn,
+                   buf_base(&stream->buf), buf_len(&stream->buf));
+        stream->code = 0;
+        buf_reset(&stream->buf);
+    }
+
+    return 0;
+}
+
+static void jmap_stream_end(struct jmap_stream *stream)
+{
+    write_body(stream->code, stream->txn,
+               buf_base(&stream->buf), buf_len(&stream->buf));
+
+    /* End of chunked response */
+    if (!stream->code) write_body(0, stream->txn, NULL, 0);
+
+    buf_free(&stream->buf);
+}
+
 /* Perform a POST request */
 static int jmap_post(struct transaction_t *txn,
                      void *params __attribute__((unused)))
@@ -670,9 +716,9 @@ static int jmap_post(struct transaction_t *txn,
     };
     size_t i, flags = JSON_PRESERVE_ORDER;
     int ret;
-    char *buf, *inboxname = NULL;
+    char *inboxname = NULL;
     hash_table accounts = HASH_TABLE_INITIALIZER;
-    hash_table mboxrights = HASH_TABLE_INITIALIZER;
+    struct hashmap mboxrights = HASHMAP_INITIALIZER;
     strarray_t methods = STRARRAY_INITIALIZER;
 
     ret = jmap_parse_path(txn);
@@ -713,7 +759,7 @@ static int jmap_post(struct transaction_t *txn,
     construct_hash_table(&idmap.contacts, 64, 0);
 
     construct_hash_table(&accounts, 8, 0);
-    construct_hash_table(&mboxrights, 64, 0);
+    hashmap_init(&mboxrights, 64);
 
     /* Process each method call in the request */
     json_t *mc;
@@ -817,22 +863,36 @@ static int jmap_post(struct transaction_t *txn,
                        strarray_join(&methods, ","), txn->req_hdrs);
 
 
-    /* Dump JSON object into a text buffer */
-    json_t *res = json_pack("{s:O}", "methodResponses", resp);
+    /* Output the JSON object, one method response at a time */
     flags |= (config_httpprettytelemetry ? JSON_INDENT(2) : JSON_COMPACT);
-    buf = json_dumps(res, flags);
-    json_decref(res);
+    txn->resp_body.type = "application/json; charset=utf-8";
 
-    if (!buf) {
-        txn->error.desc = "Error dumping JSON response object";
-        ret = HTTP_SERVER_ERROR;
-        goto done;
+    struct jmap_stream stream = { txn, HTTP_OK, BUF_INITIALIZER };
+    buf_setcstr(&stream.buf, "{\"methodResponses\":[");
+    for (i = 0; i < json_array_size(resp); i++) {
+        if (i) buf_putc(&stream.buf, ',');
+        if (json_dump_callback(json_array_get(resp, i),
+                               &jmap_stream_cb, &stream, flags)) {
+            syslog(LOG_ERR, "jmap_post: error dumping method response %zu",
+                   i);
+            buf_free(&stream.buf);
+            if (stream.code) {
+                /* Nothing sent yet, so we can still report the error */
+                txn->error.desc = "Error dumping JSON response object";
+                ret = HTTP_SERVER_ERROR;
+            }
+            else {
+                /* Part of the body is already out: don't terminate it
+                   as if it were complete, drop the connection instead */
+                txn->flags.conn = CONN_CLOSE;
+            }
+            goto done;
+        }
+        /* We're done with this part of the tree */
+        json_array_set_new(resp, i, json_null());
     }
-
-    /* Output the JSON object */
-    txn->resp_body.type = "application/json; charset=utf-8";
-    write_body(HTTP_OK, txn, buf, strlen(buf));
-    free(buf);
+    buf_appendcstr(&stream.buf, "]}");
+    jmap_stream_end(&stream);
 
   done:
     free_hash_table(&idmap.mailboxes, free);
@@ -842,7 +902,7 @@ static int jmap_post(struct transaction_t *txn,
     free_hash_table(&idmap.contactgroups, free);
     free_hash_table(&idmap.contacts, free);
     free_hash_table(&accounts, NULL);
-    free_hash_table(&mboxrights, free);
+    hashmap_fini(&mboxrights, free);
     free(inboxname);
     if (req) json_decref(req);
     if (resp) json_decref(resp);
@@ -1167,8 +1227,8 @@ EXPORTED int jmap_download(struct transaction_t *txn)
 
 
     /* Initialize ACL mailbox cache for findblob */
-    hash_table mboxrights = HASH_TABLE_INITIALIZER;
-    construct_hash_table(&mboxrights, 64, 0);
+    struct hashmap mboxrights = HASHMAP_INITIALIZER;
+    hashmap_init(&mboxrights, 64);
     req.mboxrights = &mboxrights;
 
     jmap_initreq(&req);
@@ -1239,7 +1299,7 @@ EXPORTED int jmap_download(struct transaction_t *txn)
     write_body(HTTP_OK, txn, base, len);
 
  done:
-    free_hash_table(&mboxrights, free);
+    hashmap_fini(&mboxrights, free);
     free(accountid);
     free(decbuf);
     free(ctype);
@@ -2069,22 +2129,22 @@ static int jmap_settings(struct transaction_t *txn)
 
 static int myrights(struct auth_state *authstate,
                     const mbentry_t *mbentry,
-                    hash_table *mboxrights)
+                    struct hashmap *mboxrights)
 {
-    int *rightsptr = hash_lookup(mbentry->name, mboxrights);
+    int *rightsptr = hashmap_lookup(mboxrights, mbentry->name);
     if (!rightsptr) {
         rightsptr = xmalloc(sizeof(int));
         *rightsptr = httpd_myrights(authstate, mbentry);
-        hash_insert(mbentry->name, rightsptr, mboxrights);
+        hashmap_insert(mboxrights, mbentry->name, rightsptr);
     }
     return *rightsptr;
 }
 
 static int myrights_byname(struct auth_state *authstate,
                            const char *mboxname,
-                           hash_table *mboxrights)
+                           struct hashmap *mboxrights)
 {
-    int *rightsptr = hash_lookup(mboxname, mboxrights);
+    int *rightsptr = hashmap_lookup(mboxrights, mboxname);
     if (!rightsptr) {
         mbentry_t *mbentry = NULL;
         if (mboxlist_lookup(mboxname, &mbentry, NULL)) {
@@ -2093,7 +2153,7 @@ static int myrights_byname(struct auth_state *authstate,
         rightsptr = xmalloc(sizeof(int));
         *rightsptr = httpd_myrights(authstate, mbentry);
         mboxlist_entry_free(&mbentry);
-        hash_insert(mboxname, rightsptr, mboxrights);
+        hashmap_insert(mboxrights, mboxname, rightsptr);
     }
     return *rightsptr;
 }
@@ -2120,7 +2180,7 @@ EXPORTED void jmap_myrights_delete(jmap_req_t *req, const char *mboxname)
     if (!req->is_shared_account) {
         return;
     }
-    int *rightsptr = hash_del(mboxname, req->mboxrights);
+    int *rightsptr = hashmap_del(req->mboxrights, mboxname);
     free(rightsptr);
 }
 
@@ -92,7 +92,7 @@ typedef struct jmap_req {
     /* Owned by JMAP HTTP handler */
     ptrarray_t *mboxes;
     int is_shared_account;
-    hash_table *mboxrights;
+    struct hashmap *mboxrights;
 } jmap_req_t;
 
 typedef struct {
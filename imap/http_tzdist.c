@@ -175,10 +175,11 @@ struct tz_shape_t {
     int valid;
     SHPHandle shp;
     DBFHandle dbf;
+    SHPTree *tree;      /* quadtree of shape bounding boxes */
 };
 
-static struct tz_shape_t tz_world = { 0, NULL, NULL };
-static struct tz_shape_t tz_aq    = { 0, NULL, NULL };
+static struct tz_shape_t tz_world = { 0, NULL, NULL, NULL };
+static struct tz_shape_t tz_aq    = { 0, NULL, NULL, NULL };
 
 static void open_shape_file(struct buf *serverinfo)
 {
@@ -218,6 +219,15 @@ static void open_shape_file(struct buf *serverinfo)
         return;
     }
 
+    /* Index the boundary bounding boxes so that lookups only need to
+       read the few polygons that could possibly contain the point */
+    tz_world.tree = SHPCreateTree(tz_world.shp, 2, 0, NULL, NULL);
+    if (!tz_world.tree) {
+        syslog(LOG_WARNING,
+               "Failed to index %s%s%s - using linear search",
+               config_dir, FNAME_ZONEINFODIR, FNAME_WORLD_SHAPEFILE);
+    }
+
     geo_enabled = tz_world.valid = 1;
 
     /* Open the tz_antarctica shape files (optional) */
@@ -255,6 +265,7 @@ static void open_shape_file(struct buf *serverinfo)
 
 static void close_shape_file()
 {
+    if (tz_world.tree) SHPDestroyTree(tz_world.tree);
     if (tz_world.dbf) DBFClose(tz_world.dbf);
     if (tz_world.shp) SHPClose(tz_world.shp);
     if (tz_aq.dbf) DBFClose(tz_aq.dbf);
@@ -380,7 +391,7 @@ static strarray_t *tzid_from_geo(struct transaction_t *txn,
     strarray_t *tzids = strarray_new();
     const char *tzid;
     struct vector p, a;
-    int i, npoly;
+    int i, n, npoly, *polys = NULL;
     double minbound[4], maxbound[4];
 
     /* using unit vectors */
@@ -430,8 +441,36 @@ static strarray_t *tzid_from_geo(struct transaction_t *txn,
         (uncertainty && pt_near_poly(5, WbbX, WbbY, &p, uncertainty))) {
         /* Check if point is within or near a time zone boundary */
 
-        for (i = 0; i < npoly; i++) {
-            SHPObject *poly = SHPReadObject(tz_world.shp, i);
+        if (tz_world.tree) {
+            /* Only look at boundaries whose bounding box intersects
+               the search box around the point */
+            double qmin[4] = { -180.0, -90.0, 0.0, 0.0 };
+            double qmax[4] = {  180.0,  90.0, 0.0, 0.0 };
+            double dlat = uncertainty / M_PI_180;  /* radians -> degrees */
+            double maxlat = fabs(latitude) + dlat;
+
+            qmin[1] = latitude - dlat;
+            qmax[1] = latitude + dlat;
+            if (maxlat < 90.0) {
+                /* Longitudinal extent of the uncertainty widens toward
+                   the poles; near a pole or across the antimeridian
+                   just search the full longitude range */
+                double dlon = dlat / cos(deg2rad(maxlat));
+
+                if (longitude - dlon >= -180.0 && longitude + dlon <= 180.0) {
+                    qmin[0] = longitude - dlon;
+                    qmax[0] = longitude + dlon;
+                }
+            }
+
+            polys = SHPTreeFindLikelyShapes(tz_world.tree, qmin, qmax, &npoly);
+        }
+
+        for (n = 0; n < npoly; n++) {
+            SHPObject *poly;
+
+            i = polys ? polys[n] : n;
+            poly = SHPReadObject(tz_world.shp, i);
             double bbX[5] = { poly->dfXMin, poly->dfXMin,
                               poly->dfXMax, poly->dfXMax, poly->dfXMin };
             double bbY[5] = { poly->dfYMin, poly->dfYMax,
@@ -465,6 +504,8 @@ static strarray_t *tzid_from_geo(struct transaction_t *txn,
 
             keepalive_response(txn);
         }
+
+        free(polys);
     }
 
     if (!strarray_size(tzids)) {
@@ -85,6 +85,7 @@
 #include "xstrlcat.h"
 #include "telemetry.h"
 #include "backend.h"
+#include "prometheus.h"
 #include "proxy.h"
 #include "userdeny.h"
 #include "message.h"
@@ -474,6 +475,43 @@ struct namespace_t *namespaces[] = {
 };
 
 
+/*
+ * Detach cached backend connections from the client session that is
+ * ending so that they can be reused by the next session in this process.
+ * Backend connections are authenticated as the proxy admin, and
+ * proxy_findserver() pings (re-authorizes as the new user) a cached
+ * connection before reusing it, dropping it if that fails.
+ */
+static void pool_backends(void)
+{
+    int i, j;
+
+    for (i = j = 0; backend_cached && backend_cached[i]; i++) {
+        struct backend *be = backend_cached[i];
+
+        if (be->sock != -1) {
+            /* the timeout is attached to the client's protstream */
+            if (be->timeout) prot_removewaitevent(be->clientin, be->timeout);
+            be->timeout = NULL;
+            be->clientin = NULL;
+            be->current = be->inbox = NULL;
+            backend_cached[j++] = be;
+        }
+        else {
+            free(be->context);
+            free(be);
+        }
+    }
+
+    if (backend_cached) {
+        backend_cached[j] = NULL;
+        if (!j) {
+            free(backend_cached);
+            backend_cached = NULL;
+        }
+    }
+}
+
 static void httpd_reset(struct http_connection *conn)
 {
     int i;
@@ -491,16 +529,21 @@ static void httpd_reset(struct http_connection *conn)
 
     proc_cleanup();
 
-    /* close backend connections */
-    i = 0;
-    while (backend_cached && backend_cached[i]) {
-        proxy_downserver(backend_cached[i]);
-        free(backend_cached[i]->context);
-        free(backend_cached[i]);
-        i++;
+    /* close backend connections, or keep them for the next client */
+    if (config_getswitch(IMAPOPT_HTTPPROXYPOOL)) {
+        pool_backends();
+    }
+    else {
+        i = 0;
+        while (backend_cached && backend_cached[i]) {
+            proxy_downserver(backend_cached[i]);
+            free(backend_cached[i]->context);
+            free(backend_cached[i]);
+            i++;
+        }
+        if (backend_cached) free(backend_cached);
+        backend_cached = NULL;
     }
-    if (backend_cached) free(backend_cached);
-    backend_cached = NULL;
     backend_current = NULL;
 
     if (httpd_in) {
@@ -1734,6 +1777,9 @@ static void cmdloop(struct http_connection *conn)
 
             /* Handle errors (success responses handled by method functions) */
             if (ret) error_response(ret, &txn);
+
+            /* The whole response has been written by now */
+            transaction_done(&txn);
         }
 
         if (ret == HTTP_SHUTDOWN) {
@@ -2757,6 +2803,44 @@ EXPORTED void response_header(long code, struct transaction_t *txn)
 }
 
 
+/* Record the latency of a request once its response has been written
+ * out in full.  response_header() is too early for this: it runs
+ * before any chunked or streamed body, and for interim responses. */
+EXPORTED void transaction_done(struct transaction_t *txn)
+{
+    /* Indexed by METH_*; must stay in sync with http_methods[] */
+    static const enum prom_metric_id meth_duration[METH_UNKNOWN] = {
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_ACL,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_BIND,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_COPY,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_DELETE,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_GET,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_HEAD,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_LOCK,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_MKCALENDAR,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_MKCOL,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_MOVE,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_OPTIONS,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_PATCH,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_POST,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_PROPFIND,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_PROPPATCH,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_PUT,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_REPORT,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_TRACE,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_UNBIND,
+        CYRUS_HTTP_REQUEST_DURATION_SECONDS_METHOD_UNLOCK,
+    };
+    double cmdtime, nettime;
+
+    /* request never got as far as a known method */
+    if (txn->meth >= METH_UNKNOWN) return;
+
+    cmdtime_endtimer(&cmdtime, &nettime);
+    prometheus_observe(meth_duration[txn->meth], cmdtime + nettime);
+}
+
+
 EXPORTED void keepalive_response(struct transaction_t *txn)
 {
     if (gotsigalrm) {
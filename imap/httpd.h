@@ -540,6 +540,7 @@ extern int check_precond(struct transaction_t *txn,
 
 extern int examine_request(struct transaction_t *txn);
 extern int client_need_auth(struct transaction_t *txn, int sasl_result);
+extern void transaction_done(struct transaction_t *txn);
 extern void transaction_free(struct transaction_t *txn);
 
 extern int httpd_myrights(struct auth_state *authstate, const mbentry_t *mbentry);
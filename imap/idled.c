@@ -54,12 +54,15 @@
 #endif
 #include <signal.h>
 #include <fcntl.h>
+#include <sys/time.h>
 
 #include "idlemsg.h"
 #include "global.h"
 #include "mboxlist.h"
 #include "xmalloc.h"
-#include "hash.h"
+#include "xstrlcpy.h"
+#include "hashmap.h"
+#include "strarray.h"
 #include "exitcodes.h"
 
 extern int optind;
@@ -74,7 +77,16 @@ struct ientry {
     time_t itime;
     struct ientry *next;
 };
-static struct hash_table itable;
+static struct hashmap itable = HASHMAP_INITIALIZER;
+
+/* A burst of changes to one mailbox (e.g. a multi-message append or
+ * expunge) produces one NOTIFY per change.  Rather than forwarding each
+ * of them to every idler, hold the mailbox for a few milliseconds and
+ * forward a single NOTIFY for the whole burst. */
+#define IDLE_COALESCE_USEC 5000
+
+static struct hashmap ptable = HASHMAP_INITIALIZER;
+static unsigned npending = 0;
 
 EXPORTED void fatal(const char *msg, int err)
 {
@@ -87,21 +99,13 @@ EXPORTED void fatal(const char *msg, int err)
     exit(err);
 }
 
-static int mbox_count_cb(const mbentry_t *mbentry __attribute__((unused)), void *rockp)
-{
-    int *ip = (int *) rockp;
-    (*ip)++;
-
-    return 0;
-}
-
 /* remove an ientry from list of those idling on mboxname */
 static void remove_ientry(const char *mboxname,
                           const struct sockaddr_un *remote)
 {
     struct ientry *t, *p = NULL;
 
-    t = (struct ientry *) hash_lookup(mboxname, &itable);
+    t = (struct ientry *) hashmap_lookup(&itable, mboxname);
     while (t && memcmp(&t->remote, remote, sizeof(*remote))) {
         p = t;
         t = t->next;
@@ -114,7 +118,7 @@ static void remove_ientry(const char *mboxname,
 
             /* we just removed the data that the hash entry
                was pointing to, so insert the new data */
-            hash_insert(mboxname, p, &itable);
+            hashmap_insert(&itable, mboxname, p);
         }
         else {
             /* not the first ientry in the linked list */
@@ -127,11 +131,96 @@ static void remove_ientry(const char *mboxname,
 
 
 
-static void process_message(struct sockaddr_un *remote, idle_message_t *msg)
+/* send a NOTIFY to all clients idling on mboxname */
+static void notify_clients(const char *mboxname)
 {
     struct ientry *t, *n;
+    idle_message_t msg;
     int r;
 
+    msg.which = IDLE_MSG_NOTIFY;
+    strlcpy(msg.mboxname, mboxname, sizeof(msg.mboxname));
+
+    t = (struct ientry *) hashmap_lookup(&itable, mboxname);
+    for ( ; t ; t = n) {
+        n = t->next;
+        if ((t->itime + idle_timeout) < time(NULL)) {
+            /* This process has been idling for longer than the timeout
+             * period, so it probably died.  Remove it from the list.
+             */
+            if (verbose || debugmode)
+                syslog(LOG_DEBUG, "    TIMEOUT %s\n", idle_id_from_addr(&t->remote));
+
+            remove_ientry(mboxname, &t->remote);
+        }
+        else { /* signal process to update */
+            if (verbose || debugmode)
+                syslog(LOG_DEBUG, "    fwd NOTIFY %s\n", idle_id_from_addr(&t->remote));
+
+            /* forward the notification onto our clients */
+            r = idle_send(&t->remote, &msg);
+            if (r) {
+                /* ENOENT can happen as result of a race between delivering
+                 * messages and shutting down imapd.  It indicates that the
+                 * imapd's socket was unlinked, which means that imapd went
+                 * through it's graceful shutdown path, so don't syslog. */
+                if (r != ENOENT)
+                    syslog(LOG_ERR, "IDLE: error sending message "
+                                    "NOTIFY to imapd %s for mailbox %s: %s, "
+                                    "forgetting.",
+                                    idle_id_from_addr(&t->remote),
+                                    mboxname, error_message(r));
+                if (verbose || debugmode)
+                    syslog(LOG_DEBUG, "    forgetting %s\n", idle_id_from_addr(&t->remote));
+                remove_ientry(mboxname, &t->remote);
+            }
+        }
+    }
+}
+
+struct flush_rock {
+    struct timeval now;
+    int force;
+    strarray_t due;
+};
+
+static void find_due(const char *key, void *data, void *rock)
+{
+    struct timeval *due = (struct timeval *) data;
+    struct flush_rock *frock = (struct flush_rock *) rock;
+
+    if (frock->force || !timercmp(&frock->now, due, <))
+        strarray_append(&frock->due, key);
+}
+
+/* forward a single NOTIFY for each pending mailbox whose window has
+ * elapsed (or every pending mailbox, if force is set) */
+static void flush_pending(int force)
+{
+    struct flush_rock frock = { { 0, 0 }, force, STRARRAY_INITIALIZER };
+    int i;
+
+    if (!npending) return;
+
+    gettimeofday(&frock.now, NULL);
+    hashmap_enumerate(&ptable, find_due, &frock);
+
+    for (i = 0; i < frock.due.count; i++) {
+        const char *mboxname = strarray_nth(&frock.due, i);
+
+        free(hashmap_del(&ptable, mboxname));
+        npending--;
+        notify_clients(mboxname);
+    }
+
+    strarray_fini(&frock.due);
+}
+
+static void process_message(struct sockaddr_un *remote, idle_message_t *msg)
+{
+    struct ientry *t, *n;
+    struct timeval *due;
+
     switch (msg->which) {
     case IDLE_MSG_INIT:
         if (verbose || debugmode)
@@ -139,54 +228,33 @@ static void process_message(struct sockaddr_un *remote, idle_message_t *msg)
                    idle_id_from_addr(remote), msg->mboxname);
 
         /* add an ientry to list of those idling on mboxname */
-        t = (struct ientry *) hash_lookup(msg->mboxname, &itable);
+        t = (struct ientry *) hashmap_lookup(&itable, msg->mboxname);
         n = (struct ientry *) xzmalloc(sizeof(struct ientry));
         n->remote = *remote;
         n->itime = time(NULL);
         n->next = t;
-        hash_insert(msg->mboxname, n, &itable);
+        hashmap_insert(&itable, msg->mboxname, n);
         break;
 
     case IDLE_MSG_NOTIFY:
         if (verbose || debugmode)
             syslog(LOG_DEBUG, "IDLE_MSG_NOTIFY '%s'\n", msg->mboxname);
 
-        /* send a message to all clients idling on mboxname */
-        t = (struct ientry *) hash_lookup(msg->mboxname, &itable);
-        for ( ; t ; t = n) {
-            n = t->next;
-            if ((t->itime + idle_timeout) < time(NULL)) {
-                /* This process has been idling for longer than the timeout
-                 * period, so it probably died.  Remove it from the list.
-                 */
-                if (verbose || debugmode)
-                    syslog(LOG_DEBUG, "    TIMEOUT %s\n", idle_id_from_addr(&t->remote));
+        /* nobody is idling on mboxname, nothing to forward */
+        if (!hashmap_lookup(&itable, msg->mboxname)) break;
 
-                remove_ientry(msg->mboxname, &t->remote);
-            }
-            else { /* signal process to update */
-                if (verbose || debugmode)
-                    syslog(LOG_DEBUG, "    fwd NOTIFY %s\n", idle_id_from_addr(&t->remote));
-
-                /* forward the received msg onto our clients */
-                r = idle_send(&t->remote, msg);
-                if (r) {
-                    /* ENOENT can happen as result of a race between delivering
-                     * messages and shutting down imapd.  It indicates that the
-                     * imapd's socket was unlinked, which means that imapd went
-                     * through it's graceful shutdown path, so don't syslog. */
-                    if (r != ENOENT)
-                        syslog(LOG_ERR, "IDLE: error sending message "
-                                        "NOTIFY to imapd %s for mailbox %s: %s, "
-                                        "forgetting.",
-                                        idle_id_from_addr(&t->remote),
-                                        msg->mboxname, error_message(r));
-                    if (verbose || debugmode)
-                        syslog(LOG_DEBUG, "    forgetting %s\n", idle_id_from_addr(&t->remote));
-                    remove_ientry(msg->mboxname, &t->remote);
-                }
-            }
+        /* already pending: this change will go out with the earlier one */
+        if (hashmap_lookup(&ptable, msg->mboxname)) break;
+
+        due = xmalloc(sizeof(struct timeval));
+        gettimeofday(due, NULL);
+        due->tv_usec += IDLE_COALESCE_USEC;
+        if (due->tv_usec >= 1000000) {
+            due->tv_sec++;
+            due->tv_usec -= 1000000;
         }
+        hashmap_insert(&ptable, msg->mboxname, due);
+        npending++;
         break;
 
     case IDLE_MSG_DONE:
@@ -250,7 +318,8 @@ static void send_alert(const char *key,
 static void shut_down(int ec) __attribute__((noreturn));
 static void shut_down(int ec)
 {
-    hash_enumerate(&itable, send_alert, NULL);
+    flush_pending(1);
+    hashmap_enumerate(&itable, send_alert, NULL);
     idle_done_sock();
     cyrus_done();
     exit(ec);
@@ -260,7 +329,6 @@ int main(int argc, char **argv)
 {
     char *p = NULL;
     int opt;
-    int nmbox = 0;
     int s;
     struct sockaddr_un local;
     fd_set read_set, rset;
@@ -294,14 +362,15 @@ int main(int argc, char **argv)
     if (idle_timeout < 30) idle_timeout = 30;
     idle_timeout *= 60;
 
-    /* count the number of mailboxes */
-    mboxlist_allmbox("", &mbox_count_cb, &nmbox, /*incdel*/0);
-
     signals_set_shutdown(shut_down);
     signals_add_handlers(0);
 
-    /* create idle table -- +1 to avoid a zero value */
-    construct_hash_table(&itable, nmbox + 1, 1);
+    /* create idle table -- it grows with the number of mailboxes being
+     * idled on, so there's no need to count every mailbox up front */
+    hashmap_init(&itable, 1024);
+
+    /* create table of mailboxes with a NOTIFY waiting to go out */
+    hashmap_init(&ptable, 1024);
 
     if (!idle_make_server_address(&local) ||
         !idle_init_sock(&local)) {
@@ -345,9 +414,16 @@ int main(int argc, char **argv)
             shut_down(1);
         }
 
-        /* timeout for select is 1 second */
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+        /* timeout for select is 1 second, unless there are
+           notifications waiting to be forwarded */
+        if (npending) {
+            timeout.tv_sec = 0;
+            timeout.tv_usec = IDLE_COALESCE_USEC;
+        }
+        else {
+            timeout.tv_sec = 1;
+            timeout.tv_usec = 0;
+        }
 
         /* check for the next input */
         rset = read_set;
@@ -370,6 +446,9 @@ int main(int argc, char **argv)
                 process_message(&from, &msg);
         }
 
+        /* forward any notifications whose window has elapsed */
+        flush_pending(0);
+
     }
 
     /* NOTREACHED */
@@ -58,6 +58,7 @@
 #include <sys/wait.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/time.h>
 #include <time.h>
 #include <stdbool.h>
 #include <errno.h>
@@ -1179,15 +1180,47 @@ static void imapd_check(struct backend *be, int usinguid)
 /*
  * Top-level command loop parsing
  */
+/*
+ * Record the latency of the commands we keep a histogram for.
+ * UID variants have already had cmdname rewritten to the subcommand.
+ */
+static void cmdloop_observe(const char *cmdname, const struct timeval *start)
+{
+    static const struct {
+        const char *name;
+        enum prom_metric_id metric_id;
+    } timed_cmds[] = {
+        { "append", CYRUS_IMAP_COMMAND_DURATION_SECONDS_COMMAND_APPEND },
+        { "fetch",  CYRUS_IMAP_COMMAND_DURATION_SECONDS_COMMAND_FETCH },
+        { "search", CYRUS_IMAP_COMMAND_DURATION_SECONDS_COMMAND_SEARCH },
+        { "sort",   CYRUS_IMAP_COMMAND_DURATION_SECONDS_COMMAND_SORT },
+        { NULL,     0 }
+    };
+    struct timeval end;
+    int i;
+
+    for (i = 0; timed_cmds[i].name; i++) {
+        if (!strcmp(cmdname, timed_cmds[i].name)) {
+            gettimeofday(&end, NULL);
+            prometheus_observe(timed_cmds[i].metric_id, timesub(start, &end));
+            return;
+        }
+    }
+}
+
 static void cmdloop(void)
 {
     int c;
     int usinguid, havepartition, havenamespace, recursive;
     static struct buf tag, cmd, arg1, arg2, arg3;
     char *p, shut[MAX_MAILBOX_PATH+1], cmdname[100];
+    struct timeval cmdstart;
     const char *err;
     const char * commandmintimer;
     double commandmintimerd = 0.0;
+    const char *commandtracetimer;
+    double commandtracetimerd = 0.0;
+    struct xstats_snapshot cmdsnap;
     struct sync_reserve_list *reserve_list =
         sync_reserve_list_create(SYNC_MESSAGE_LIST_HASH_SIZE);
     struct applepushserviceargs applepushserviceargs;
@@ -1215,6 +1248,12 @@ static void cmdloop(void)
       commandmintimerd = atof(commandmintimer);
     }
 
+    /* Likewise for the per-command resource trace */
+    commandtracetimer = config_getstring(IMAPOPT_COMMANDTRACETIMER);
+    if (commandtracetimer) {
+        commandtracetimerd = atof(commandtracetimer);
+    }
+
     for (;;) {
         /* Release any held index */
         index_release(imapd_index);
@@ -1295,6 +1334,8 @@ static void cmdloop(void)
 
         /* Start command timer */
         cmdtime_starttimer();
+        gettimeofday(&cmdstart, NULL);
+        if (commandtracetimer) xstats_snapshot(&cmdsnap);
 
         /* note that about half the commands (the common ones that don't
            hit the mailboxes file) now close the mailboxes file just in
@@ -2444,6 +2485,15 @@ static void cmdloop(void)
             eatline(imapd_in, c);
         }
 
+        cmdloop_observe(cmdname, &cmdstart);
+
+        /* Trace resource usage of slow commands - not "idle" either */
+        if (commandtracetimer && strcmp("idle", cmdname) &&
+            xstats_elapsed(&cmdsnap) >= commandtracetimerd) {
+            xstats_trace(&cmdsnap, cmdname, imapd_userid,
+                         index_mboxname(imapd_index));
+        }
+
         /* End command timer - don't log "idle" commands */
         if (commandmintimer && strcmp("idle", cmdname)) {
             double cmdtime, nettime;
@@ -3171,6 +3221,8 @@ static void cmd_idle(char *tag)
 
         index_release(imapd_index);
         while ((flags = idle_wait(imapd_in->fd))) {
+            struct timeval wakeup = { 0, 0 };
+
             if (deadline_exceeded(&deadline)) {
                 syslog(LOG_DEBUG, "timeout for user '%s' while idling",
                        imapd_userid);
@@ -3185,8 +3237,10 @@ static void cmd_idle(char *tag)
             }
 
             /* Send unsolicited untagged responses to the client */
-            if (flags & IDLE_MAILBOX)
+            if (flags & IDLE_MAILBOX) {
+                gettimeofday(&wakeup, NULL);
                 index_check(imapd_index, 1, 0);
+            }
 
             if (flags & IDLE_ALERT) {
                 char shut[MAX_MAILBOX_PATH+1];
@@ -3203,6 +3257,13 @@ static void cmd_idle(char *tag)
 
             index_release(imapd_index);
             prot_flush(imapd_out);
+
+            if (flags & IDLE_MAILBOX) {
+                struct timeval now;
+                gettimeofday(&now, NULL);
+                prometheus_observe(CYRUS_IMAP_COMMAND_DURATION_SECONDS_COMMAND_IDLE,
+                                   timesub(&wakeup, &now));
+            }
         }
 
         /* Stop updates and do any necessary cleanup */
@@ -5087,7 +5148,7 @@ static void do_one_xconvmeta(struct conversations_state *state,
         else if (!strcasecmp(key, "SENDERS")) {
             conv_sender_t *sender;
             struct dlist *slist = dlist_newlist(item, "SENDERS");
-            for (sender = conv->senders; sender; sender = sender->next) {
+            for (sender = conversation_get_senders(conv); sender; sender = sender->next) {
                 struct dlist *sli = dlist_newlist(slist, "");
                 dlist_setatom(sli, "NAME", sender->name);
                 dlist_setatom(sli, "ROUTE", sender->route);
@@ -12945,9 +13006,17 @@ static void list_data(struct listargs *listargs)
     }
     else {
         struct list_rock rock;
+        char *inbox = NULL;
         memset(&rock, 0, sizeof(struct list_rock));
         rock.listargs = listargs;
 
+        if ((listargs->ret & LIST_RET_STATUS) && imapd_userid &&
+            config_getswitch(IMAPOPT_STATUSCACHE)) {
+            /* read the cached STATUS of all the user's folders at once */
+            inbox = mboxname_user_mbox(imapd_userid, NULL);
+            statuscache_prefetch(inbox, imapd_userid);
+        }
+
         if (listargs->sel & LIST_SEL_SUBSCRIBED) {
             mboxlist_findsubmulti(&imapd_namespace, &listargs->pat,
                                   imapd_userisadmin, imapd_userid,
@@ -12974,6 +13043,11 @@ static void list_data(struct listargs *listargs)
         }
 
         if (rock.last_name) free(rock.last_name);
+
+        if (inbox) {
+            statuscache_prefetch_done();
+            free(inbox);
+        }
     }
 }
 
@@ -67,6 +67,7 @@
 #include "dlist.h"
 #include "exitcodes.h"
 #include "hash.h"
+#include "hashmap.h"
 #include "hashu64.h"
 #include "global.h"
 #include "times.h"
@@ -1236,6 +1237,8 @@ EXPORTED int index_store(struct index_state *state, char *sequence,
     struct index_modified_flags modified_flags;
     struct index_record record;
     msgrecord_t *msgrec = NULL;
+    struct conversations_state *cstate = NULL;
+    int batching = 0;
 
     /* First pass at checking permission */
     if ((storeargs->seen && !(state->myrights & ACL_SETSEEN)) ||
@@ -1335,6 +1338,15 @@ EXPORTED int index_store(struct index_state *state, char *sequence,
         if (!dirty)
             continue;
 
+        /* for flag changes, sum up the conversation count changes and
+         * apply them once per conversation rather than once per record.
+         * Don't lock the conversations db until something changes */
+        if (!batching && storeargs->operation != STORE_ANNOTATION) {
+            cstate = mailbox_get_cstate(mailbox);
+            if (cstate) conversations_batch_begin(cstate, mailbox);
+            batching = 1;
+        }
+
         r = msgrecord_rewrite(msgrec);
         if (r) goto out;
 
@@ -1349,6 +1361,13 @@ EXPORTED int index_store(struct index_state *state, char *sequence,
         msgrecord_unref(&msgrec);
     }
 
+    /* the events below report conversation counts, so bring the
+     * conversations db up to date first */
+    if (cstate) {
+        r = conversations_batch_end(cstate);
+        cstate = NULL;
+        if (r) goto out;
+    }
 
     /* let mboxevent_notify split FlagsSet into MessageRead, MessageTrash
      * and FlagsSet events */
@@ -1367,6 +1386,11 @@ out:
     mboxevent_freequeue(&mboxevents);
     if (storeargs->operation == STORE_ANNOTATION && r)
         annotate_state_abort(&mailbox->annot_state);
+    if (cstate) {
+        /* on error the records rewritten so far still need applying */
+        int r2 = conversations_batch_end(cstate);
+        if (!r) r = r2;
+    }
     seqset_free(seq);
     index_unlock(state);
     index_tellchanges(state, storeargs->usinguid, storeargs->usinguid,
@@ -5973,7 +5997,7 @@ static void thread_orphan_child(Thread *child)
  * Link messages together using message-id and references.
  */
 static void ref_link_messages(MsgData **msgdata, unsigned int nmsg,
-                              Thread **newnode, struct hash_table *id_table)
+                              Thread **newnode, struct hashmap *id_table)
 {
     Thread *cur, *parent, *ref;
     unsigned int mi;
@@ -5989,7 +6013,7 @@ static void ref_link_messages(MsgData **msgdata, unsigned int nmsg,
          *
          * if we already have a container, use it
          */
-        if ((cur = (Thread *) hash_lookup(msg->msgid, id_table))) {
+        if ((cur = (Thread *) hashmap_lookup(id_table, msg->msgid))) {
             /* If this container is not empty, then we have a duplicate
              * Message-ID.  Make this one unique so that we don't stomp
              * on the old one.
@@ -6011,7 +6035,7 @@ static void ref_link_messages(MsgData **msgdata, unsigned int nmsg,
         if (!cur) {
             cur = *newnode;
             cur->msgdata = msg;
-            hash_insert(msg->msgid, cur, id_table);
+            hashmap_insert(id_table, msg->msgid, cur);
             (*newnode)++;
         }
 
@@ -6020,9 +6044,9 @@ static void ref_link_messages(MsgData **msgdata, unsigned int nmsg,
             /* if we don't already have a container for the reference,
              * make and index a new (empty) container
              */
-            if (!(ref = (Thread *) hash_lookup(msg->ref.data[i], id_table))) {
+            if (!(ref = (Thread *) hashmap_lookup(id_table, msg->ref.data[i]))) {
                 ref = *newnode;
-                hash_insert(msg->ref.data[i], ref, id_table);
+                hashmap_insert(id_table, msg->ref.data[i], ref);
                 (*newnode)++;
             }
 
@@ -6193,13 +6217,13 @@ static void ref_sort_root(Thread *root)
 static void ref_group_subjects(Thread *root, unsigned nroot, Thread **newnode)
 {
     Thread *cur, *old, *prev, *next, *child;
-    struct hash_table subj_table;
+    struct hashmap subj_table;
     char *subj;
 
-    /* Step 5.A: create a subj_table with one bucket for every possible
+    /* Step 5.A: create a subj_table with room for every possible
      * subject in the root set
      */
-    construct_hash_table(&subj_table, nroot, 1);
+    hashmap_init(&subj_table, nroot);
 
     /* Step 5.B: populate the table with a container for each subject
      * at the root
@@ -6219,7 +6243,7 @@ static void ref_group_subjects(Thread *root, unsigned nroot, Thread **newnode)
         if (!strlen(subj)) continue;
 
         /* Step 5.B.iii: lookup this subject in the table */
-        old = (Thread *) hash_lookup(subj, &subj_table);
+        old = (Thread *) hashmap_lookup(&subj_table, subj);
 
         /* Step 5.B.iv: insert the current container into the table iff:
          * - this subject is not in the table, OR
@@ -6232,7 +6256,7 @@ static void ref_group_subjects(Thread *root, unsigned nroot, Thread **newnode)
             (!cur->msgdata && old->msgdata) ||
             (old->msgdata && old->msgdata->is_refwd &&
              cur->msgdata && !cur->msgdata->is_refwd)) {
-          hash_insert(subj, cur, &subj_table);
+          hashmap_insert(&subj_table, subj, cur);
         }
     }
 
@@ -6254,7 +6278,7 @@ static void ref_group_subjects(Thread *root, unsigned nroot, Thread **newnode)
         if (!strlen(subj)) continue;
 
         /* Step 5.C.iii: lookup this subject in the table */
-        old = (Thread *) hash_lookup(subj, &subj_table);
+        old = (Thread *) hashmap_lookup(&subj_table, subj);
 
         /* Step 5.C.iv: if we found ourselves, skip it */
         if (!old || old == cur) continue;
@@ -6338,7 +6362,7 @@ static void ref_group_subjects(Thread *root, unsigned nroot, Thread **newnode)
         cur = prev;
     }
 
-    free_hash_table(&subj_table, NULL);
+    hashmap_fini(&subj_table, NULL);
 }
 
 /*
@@ -6407,7 +6431,7 @@ static void _index_thread_ref(struct index_state *state, unsigned *msgno_list,
     unsigned int mi;
     int tref, nnode;
     Thread *newnode;
-    struct hash_table id_table;
+    struct hashmap id_table;
     struct rootset rootset;
 
     /* Create/load the msgdata array */
@@ -6441,20 +6465,20 @@ static void _index_thread_ref(struct index_state *state, unsigned *msgno_list,
     newnode = rootset.root + 1; /* set next newnode to the second
                                    one in the array (skip the root) */
 
-    /* Step 0: create an id_table with one bucket for every possible
+    /* Step 0: create an id_table with room for every possible
      * message-id and reference (nmsg + tref)
      */
-    construct_hash_table(&id_table, nmsg + tref, 1);
+    hashmap_init(&id_table, nmsg + tref);
 
     /* Step 1: link messages together */
     ref_link_messages(msgdata, nmsg, &newnode, &id_table);
 
     /* Step 2: find the root set (gather all of the orphan messages) */
     rootset.nroot = 0;
-    hash_enumerate(&id_table, ref_gather_orphans, &rootset);
+    hashmap_enumerate(&id_table, ref_gather_orphans, &rootset);
 
     /* discard id_table */
-    free_hash_table(&id_table, NULL);
+    hashmap_fini(&id_table, NULL);
 
     /* Step 3: prune tree of empty containers - get our deposit back :^) */
     ref_prune_tree(rootset.root);
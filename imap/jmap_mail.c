@@ -5200,6 +5200,218 @@ done:
     return r;
 }
 
+/* Per-process cache of Email/query results.
+ *
+ * Webmail clients poll the same Email/query (and Email/queryChanges)
+ * over and over.  Keep the complete, unwindowed result list of the most
+ * recently used queries and reuse it for as long as the account's mail
+ * and mail folders modseqs stay the same, instead of re-running search
+ * and sort.  ACL changes, renames and deletes of mailboxes only bump
+ * the folders modseq, but they change which results are visible. */
+
+#define EMAIL_QUERYCACHE_SIZE    8
+#define EMAIL_QUERYCACHE_MAXIDS  100000
+
+struct email_querycache_entry {
+    char *key;              /* userid, accountid, collapse, filter, sort */
+    modseq_t modseq;        /* account mail modseq the results are for */
+    modseq_t foldersmodseq; /* ...and account mail folders modseq */
+    unsigned long lastuse;
+    int cancalcupdates;
+    strarray_t msgids;
+    arrayu64_t uids;
+};
+
+static struct email_querycache_entry email_querycache[EMAIL_QUERYCACHE_SIZE];
+static unsigned long email_querycache_clock;
+
+static char *_email_querycache_key(jmap_req_t *req, json_t *filter,
+                                   json_t *sort, int collapse)
+{
+    struct buf key = BUF_INITIALIZER;
+    char *s;
+
+    buf_printf(&key, "%s\x1f%s\x1f%d\x1f",
+               req->userid, req->accountid, collapse);
+
+    /* sorted keys make equivalent filters share an entry */
+    s = filter ? json_dumps(filter, JSON_SORT_KEYS|JSON_COMPACT) : NULL;
+    buf_appendcstr(&key, s ? s : "null");
+    buf_putc(&key, '\x1f');
+    free(s);
+
+    s = sort ? json_dumps(sort, JSON_SORT_KEYS|JSON_COMPACT) : NULL;
+    buf_appendcstr(&key, s ? s : "null");
+    free(s);
+
+    return buf_release(&key);
+}
+
+static void _email_querycache_entry_fini(struct email_querycache_entry *entry)
+{
+    free(entry->key);
+    strarray_fini(&entry->msgids);
+    arrayu64_fini(&entry->uids);
+    memset(entry, 0, sizeof(struct email_querycache_entry));
+}
+
+static struct email_querycache_entry *_email_querycache_lookup(const char *key,
+                                                               modseq_t modseq,
+                                                               modseq_t foldersmodseq)
+{
+    int i;
+
+    for (i = 0; i < EMAIL_QUERYCACHE_SIZE; i++) {
+        struct email_querycache_entry *entry = &email_querycache[i];
+
+        if (!entry->key || strcmp(entry->key, key)) continue;
+
+        if (entry->modseq != modseq ||
+            entry->foldersmodseq != foldersmodseq) {
+            /* stale */
+            _email_querycache_entry_fini(entry);
+            return NULL;
+        }
+
+        entry->lastuse = ++email_querycache_clock;
+        return entry;
+    }
+
+    return NULL;
+}
+
+/* Run the search for Email/query without any windowing and store the
+ * complete result list in a free (or the least recently used) cache
+ * slot.  Filters out hidden, expunged and duplicate messages and
+ * collapses threads exactly like _email_search() does. */
+static int _email_querycache_fill(jmap_req_t *req, json_t *filter,
+                                  json_t *sort, int collapse,
+                                  char *key, modseq_t modseq,
+                                  modseq_t foldersmodseq,
+                                  struct email_querycache_entry **entryp)
+{
+    struct email_querycache_entry *entry = &email_querycache[0];
+    hash_table ids = HASH_TABLE_INITIALIZER;
+    hashu64_table cids = HASHU64_TABLE_INITIALIZER;
+    struct index_state *state = NULL;
+    search_query_t *query = NULL;
+    struct sortcrit *sortcrit = NULL;
+    struct searchargs *searchargs = NULL;
+    struct index_init init;
+    char *msgid = NULL;
+    int i, r;
+
+    for (i = 1; i < EMAIL_QUERYCACHE_SIZE && entry->key; i++) {
+        if (!email_querycache[i].key ||
+            email_querycache[i].lastuse < entry->lastuse) {
+            entry = &email_querycache[i];
+        }
+    }
+    _email_querycache_entry_fini(entry);
+
+    searchargs = new_searchargs(NULL/*tag*/, GETSEARCH_CHARSET_FIRST,
+                                &jmap_namespace, req->accountid, req->authstate, 0);
+    searchargs->root = _email_buildsearch(req, filter, NULL);
+
+    memset(&init, 0, sizeof(init));
+    init.userid = req->accountid;
+    init.authstate = req->authstate;
+
+    r = index_open(req->inboxname, &init, &state);
+    if (r) goto done;
+
+    query = search_query_new(state, searchargs);
+    query->sortcrit = sortcrit = _email_buildsort(sort);
+    query->multiple = 1;
+    query->need_ids = 1;
+    query->verbose = 1;
+
+    entry->cancalcupdates = !search_is_mutable(sortcrit, searchargs);
+
+    r = search_query_run(query);
+    if (r) goto done;
+
+    construct_hash_table(&ids, query->merged_msgdata.count + 1, 0);
+    construct_hashu64_table(&cids, query->merged_msgdata.count/4+4, 0);
+
+    for (i = 0 ; i < query->merged_msgdata.count ; i++) {
+        MsgData *md = ptrarray_nth(&query->merged_msgdata, i);
+        search_folder_t *folder = md->folder;
+
+        if (!folder) continue;
+
+        if (md->system_flags & (FLAG_EXPUNGED|FLAG_DELETED))
+            continue;
+
+        if (!(jmap_myrights_byname(req, folder->mboxname) & ACL_READ))
+            continue;
+
+        free(msgid);
+        msgid = _email_id_from_guid(&md->guid);
+
+        if (hash_lookup(msgid, &ids))
+            continue;
+        hash_insert(msgid, (void*)1, &ids);
+
+        if (collapse) {
+            if (hashu64_lookup(md->cid, &cids))
+                continue;
+            hashu64_insert(md->cid, (void*)1, &cids);
+        }
+
+        strarray_append(&entry->msgids, msgid);
+        arrayu64_append(&entry->uids, md->uid);
+    }
+
+    if (strarray_size(&entry->msgids) > EMAIL_QUERYCACHE_MAXIDS) {
+        /* too big to keep around, but still good for this request */
+        free(key);
+        key = NULL;
+    }
+    entry->key = key;
+    entry->modseq = modseq;
+    entry->foldersmodseq = foldersmodseq;
+    entry->lastuse = ++email_querycache_clock;
+    *entryp = entry;
+
+done:
+    free(msgid);
+    free_hash_table(&ids, NULL);
+    free_hashu64_table(&cids, NULL);
+    if (sortcrit) freesortcrit(sortcrit);
+    if (query) search_query_free(query);
+    if (searchargs) freesearchargs(searchargs);
+    if (state) {
+        state->mailbox = NULL;
+        index_close(&state);
+    }
+    if (r) {
+        free(key);
+        _email_querycache_entry_fini(entry);
+    }
+    return r;
+}
+
+/* Find the cached results for this query, running the search if
+ * there's no valid entry.  Takes ownership of the key. */
+static int _email_querycache_get(jmap_req_t *req, json_t *filter,
+                                 json_t *sort, int collapse,
+                                 struct email_querycache_entry **entryp)
+{
+    char *key = _email_querycache_key(req, filter, sort, collapse);
+    modseq_t modseq = jmap_highestmodseq(req, 0);
+    modseq_t foldersmodseq = req->counters.mailfoldersmodseq;
+
+    *entryp = _email_querycache_lookup(key, modseq, foldersmodseq);
+    if (*entryp) {
+        free(key);
+        return 0;
+    }
+
+    return _email_querycache_fill(req, filter, sort, collapse,
+                                  key, modseq, foldersmodseq, entryp);
+}
+
 static const char *msglist_sortfields[] = {
     "receivedAt",
     "from",
@@ -5289,8 +5501,37 @@ static int jmap_email_query(jmap_req_t *req)
     window.anchor_off = query.anchor_offset;
     window.limit = query.limit;
     window.collapse = collapse_threads;
-    int r = _email_search(req, query.filter, query.sort, &window, 0,
-            &query.total, &total_threads, &query.ids, NULL, &threadids);
+    int r;
+    if (!query.anchor) {
+        /* Plain positional windows are served from the query cache */
+        struct email_querycache_entry *entry = NULL;
+        int one_mailbox_only = !collapse_threads &&
+            json_is_string(json_object_get(query.filter, "inMailbox"));
+        size_t i, end;
+
+        r = _email_querycache_get(req, query.filter, query.sort,
+                                  collapse_threads, &entry);
+        if (!r) {
+            query.total = strarray_size(&entry->msgids);
+            end = query.total;
+            if (query.limit && query.position + query.limit < end)
+                end = query.position + query.limit;
+
+            for (i = query.position; i < end; i++) {
+                json_array_append_new(query.ids,
+                        json_string(strarray_nth(&entry->msgids, i)));
+                if (one_mailbox_only &&
+                    window.highestuid < arrayu64_nth(&entry->uids, i)) {
+                    window.highestuid = arrayu64_nth(&entry->uids, i);
+                }
+            }
+            window.cancalcupdates = entry->cancalcupdates;
+        }
+    }
+    else {
+        r = _email_search(req, query.filter, query.sort, &window, 0,
+                &query.total, &total_threads, &query.ids, NULL, &threadids);
+    }
     /* FIXME _email_search is a stinkin' mess. It tries to cover all of
      * /query, /queryChanges and /changes, making *any* attempt to change
      * its code an egg dance */
@@ -5370,6 +5611,27 @@ static int jmap_email_querychanges(jmap_req_t *req)
     }
     window.uptomsgid = query.up_to_id;
     window.collapse = collapse_threads;
+
+    /* If the account's mail modseq hasn't moved past the client's state
+     * then nothing can have been added or removed: answer from the
+     * query cache without searching */
+    if (window.sincemodseq >= jmap_highestmodseq(req, 0)) {
+        struct email_querycache_entry *entry = NULL;
+
+        if (!_email_querycache_get(req, query.filter, query.sort,
+                                   collapse_threads, &entry) &&
+            entry->cancalcupdates) {
+            query.total = strarray_size(&entry->msgids);
+            query.new_state = xstrdup(query.since_state);
+
+            json_t *res = jmap_querychanges_reply(&query);
+            json_object_set(res, "collapseThreads",
+                    json_object_get(req->args, "collapseThreads"));
+            jmap_ok(req, res);
+            goto done;
+        }
+    }
+
     int r = _email_search(req, query.filter, query.sort, &window, /*include_expunged*/1,
             &query.total, &total_threads, &query.added, &query.removed, &threadids);
     /* FIXME - _email_search API deserves some serious rewrite */
@@ -5544,7 +5806,7 @@ static int jmap_thread_changes(jmap_req_t *req)
             goto done;
         }
 
-        json_array_append(conv->thread ? changes.changed : changes.destroyed, val);
+        json_array_append(conversation_get_thread(conv) ? changes.changed : changes.destroyed, val);
         conversation_free(conv);
         conv = NULL;
     }
@@ -5865,7 +6127,7 @@ static int _thread_get(jmap_req_t *req, json_t *ids,
         }
 
         json_t *ids = json_pack("[]");
-        for (thread = conv->thread; thread; thread = thread->next) {
+        for (thread = conversation_get_thread(conv); thread; thread = thread->next) {
             char *msgid = _email_id_from_guid(&thread->guid);
             json_array_append_new(ids, json_string(msgid));
             free(msgid);
@@ -7491,7 +7753,7 @@ static int _email_set_answered(jmap_req_t *req, const char *inreplyto)
         conv = NULL;
         r = conversation_load(req->cstate, cid, &conv);
         if (r) continue;
-        struct conv_thread *thread = conv->thread;
+        struct conv_thread *thread = conversation_get_thread(conv);
         do {
             guid = xstrdup(message_guid_encode(&thread->guid));
             r = conversations_guid_foreach(req->cstate, guid, _email_set_answered_cb, &rock);
@@ -52,6 +52,7 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <syslog.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -774,6 +775,9 @@ int deliver(message_data_t *msgdata, char *authuser,
         }
         else {
             /* local mailbox */
+            struct timeval start, end;
+
+            gettimeofday(&start, NULL);
             mydata.cur_rcpt = n;
 #ifdef USE_SIEVE
             struct sieve_interp_ctx ctx = { mbname_userid(mbname), NULL };
@@ -795,6 +799,10 @@ int deliver(message_data_t *msgdata, char *authuser,
             if (r) {
                 r = deliver_local(&mydata, NULL, mbname);
             }
+
+            gettimeofday(&end, NULL);
+            prometheus_observe(CYRUS_LMTP_DELIVERY_DURATION_SECONDS,
+                               timesub(&start, &end));
         }
 
         telemetry_rusage(mbname_userid(mbname));
@@ -816,6 +816,7 @@ static int _map_local_record(const struct mailbox *mailbox, const char *fname, s
 
     buf_init_mmap(buf, /*onceonly*/1, msgfd, fname, sbuf.st_size, mailbox->name);
     close(msgfd);
+    xstats_add(SPOOL_READ_BYTES, sbuf.st_size);
 
     return 0;
 }
@@ -2109,6 +2110,7 @@ EXPORTED int mailbox_find_index_record(struct mailbox *mailbox, uint32_t uid,
 static int mailbox_lock_index_internal(struct mailbox *mailbox, int locktype)
 {
     struct stat sbuf;
+    struct timeval lockstart;
     int r = 0;
     const char *header_fname = mailbox_meta_fname(mailbox, META_HEADER);
     const char *index_fname = mailbox_meta_fname(mailbox, META_INDEX);
@@ -2118,6 +2120,8 @@ static int mailbox_lock_index_internal(struct mailbox *mailbox, int locktype)
 
     r = 0;
 
+    gettimeofday(&lockstart, 0);
+
     if (locktype == LOCK_EXCLUSIVE) {
         /* handle read-only case cleanly - we need to re-open read-write first! */
         if (mailbox->is_readonly) {
@@ -2153,6 +2157,8 @@ static int mailbox_lock_index_internal(struct mailbox *mailbox, int locktype)
 
     mailbox->index_locktype = locktype;
     gettimeofday(&mailbox->starttime, 0);
+    xstats_add(MAILBOX_LOCK_WAIT_USEC,
+               timesub(&lockstart, &mailbox->starttime) * 1000000);
 
     r = stat(header_fname, &sbuf);
     if (r == -1) {
@@ -2893,6 +2899,22 @@ static void mailbox_annot_update_counts(struct mailbox *mailbox,
     }
 }
 
+/* add the sync CRCs of one record, including its annotations */
+static void synccrcs_add_record(struct mailbox *mailbox,
+                                const struct index_record *record,
+                                struct synccrcs *crcs)
+{
+    struct annot_calc_rock cr = { 0, 0 };
+
+    crcs->basic ^= crc_basic(mailbox, record);
+    crcs->annot ^= crc_virtannot(mailbox, record);
+
+    annotatemore_findall(mailbox->name, record->uid, /* all entries*/"*",
+                         /*modseq*/0, calc_one_annot, &cr, /*flags*/0);
+
+    crcs->annot ^= cr.annot;
+}
+
 /*
  * Calculate a sync CRC for the entire @mailbox using CRC algorithm
  * version @vers, optionally forcing recalculation
@@ -2915,15 +2937,7 @@ EXPORTED struct synccrcs mailbox_synccrcs(struct mailbox *mailbox, int force)
 
     struct mailbox_iter *iter = mailbox_iter_init(mailbox, 0, ITER_SKIP_EXPUNGED);
     while ((msg = mailbox_iter_step(iter))) {
-        const struct index_record *record = msg_record(msg);
-        crcs.basic ^= crc_basic(mailbox, record);
-        crcs.annot ^= crc_virtannot(mailbox, record);
-
-        struct annot_calc_rock cr = { 0, 0 };
-        annotatemore_findall(mailbox->name, record->uid, /* all entries*/"*",
-                             /*modseq*/0, calc_one_annot, &cr, /*flags*/0);
-
-        crcs.annot ^= cr.annot;
+        synccrcs_add_record(mailbox, msg_record(msg), &crcs);
     }
     mailbox_iter_done(&iter);
 
@@ -2937,6 +2951,60 @@ EXPORTED struct synccrcs mailbox_synccrcs(struct mailbox *mailbox, int force)
     return crcs;
 }
 
+/*
+ * Calculate the sync CRCs of @mailbox separately for @n slices of the
+ * UID range @minuid..@maxuid, so that two copies of a mailbox whose
+ * CRCs disagree can find out where without comparing every record.
+ * Both ends must agree on the slice boundaries, which are given by
+ * mailbox_synccrcs_slice().
+ */
+EXPORTED int mailbox_synccrcs_range(struct mailbox *mailbox,
+                                    uint32_t minuid, uint32_t maxuid,
+                                    unsigned n, struct synccrcs *crcs)
+{
+    annotate_state_t *astate = NULL;
+    const message_t *msg;
+    uint64_t span;
+    int r;
+
+    if (!n) return 0;
+    memset(crcs, 0, n * sizeof(struct synccrcs));
+    if (!minuid || maxuid < minuid) return 0;
+
+    span = (uint64_t) maxuid - minuid + 1;
+
+    /* hold annotations DB open - failure to load is an error */
+    r = mailbox_get_annotate_state(mailbox, ANNOTATE_ANY_UID, &astate);
+    if (r) return r;
+
+    /* and make sure it stays locked for the whole process */
+    annotate_state_begin(astate);
+
+    struct mailbox_iter *iter = mailbox_iter_init(mailbox, 0, ITER_SKIP_EXPUNGED);
+    mailbox_iter_startuid(iter, minuid);
+    while ((msg = mailbox_iter_step(iter))) {
+        const struct index_record *record = msg_record(msg);
+        if (record->uid < minuid) continue;
+        if (record->uid > maxuid) break;
+        synccrcs_add_record(mailbox, record,
+                            &crcs[(record->uid - minuid) * (uint64_t) n / span]);
+    }
+    mailbox_iter_done(&iter);
+
+    return 0;
+}
+
+/* the UIDs covered by slice @i of mailbox_synccrcs_range() */
+EXPORTED void mailbox_synccrcs_slice(uint32_t minuid, uint32_t maxuid,
+                                     unsigned n, unsigned i,
+                                     uint32_t *lowp, uint32_t *highp)
+{
+    uint64_t span = (uint64_t) maxuid - minuid + 1;
+
+    *lowp = minuid + (i * span + n - 1) / n;
+    *highp = minuid + ((i + 1) * span + n - 1) / n - 1;
+}
+
 static void mailbox_index_update_counts(struct mailbox *mailbox,
                                         const struct index_record *record,
                                         int is_add)
@@ -3777,13 +3845,21 @@ static int mailbox_index_unlink(struct mailbox *mailbox)
      * 2) file has been archived/unarchived, and the other one needs
      *    to be removed.
      */
+    uint32_t cleanup_flags = FLAG_NEEDS_CLEANUP;
     const message_t *msg;
+
+    /* still gotta check for FLAG_UNLINKED, because it may have been
+     * created by old code.  Woot.  Unless repacks can be deferred: then
+     * records already cleaned up stay FLAG_UNLINKED until the repack,
+     * and must not be cleaned up again on every pass.  The repack
+     * still cleans up any old ones. */
+    if (config_getint(IMAPOPT_EXPUNGE_REPACK_THRESHOLD) <= 0)
+        cleanup_flags |= FLAG_UNLINKED;
+
     struct mailbox_iter *iter = mailbox_iter_init(mailbox, 0, 0);
     while ((msg = mailbox_iter_step(iter))) {
         const struct index_record *record = msg_record(msg);
-        /* still gotta check for FLAG_UNLINKED, because it may have been
-         * created by old code.  Woot */
-        if (record->system_flags & (FLAG_NEEDS_CLEANUP | FLAG_UNLINKED)) {
+        if (record->system_flags & cleanup_flags) {
             struct index_record copyrecord = *record;
             mailbox_record_cleanup(mailbox, &copyrecord);
             copyrecord.system_flags &= ~FLAG_NEEDS_CLEANUP;
@@ -4491,11 +4567,29 @@ EXPORTED int mailbox_expunge(struct mailbox *mailbox,
     return 0;
 }
 
+/*
+ * Is there enough garbage in the index and cache files to be worth
+ * rewriting them?  A repack holds the mailbox lock for as long as it
+ * takes to copy every record, so large mailboxes with only a few
+ * unlinked records wait until more have built up.
+ */
+static int mailbox_repack_worthwhile(struct mailbox *mailbox,
+                                     unsigned numunlinked)
+{
+    int threshold = config_getint(IMAPOPT_EXPUNGE_REPACK_THRESHOLD);
+    uint64_t garbage = (uint64_t) numunlinked + mailbox->i.leaked_cache_records;
+
+    if (threshold <= 0) return 1;
+
+    return garbage * 100 >= (uint64_t) threshold * mailbox->i.num_records;
+}
+
 EXPORTED int mailbox_expunge_cleanup(struct mailbox *mailbox, time_t expunge_mark,
                             unsigned *ndeleted)
 {
     int dirty = 0;
     unsigned numdeleted = 0;
+    unsigned numunlinked = 0;
     const message_t *msg;
     time_t first_expunged = 0;
     int r = 0;
@@ -4507,6 +4601,7 @@ EXPORTED int mailbox_expunge_cleanup(struct mailbox *mailbox, time_t expunge_mar
         /* already unlinked, skip it (but dirty so we mark a repack is needed) */
         if (record->system_flags & FLAG_UNLINKED) {
             dirty = 1;
+            numunlinked++;
             continue;
         }
 
@@ -4525,9 +4620,10 @@ EXPORTED int mailbox_expunge_cleanup(struct mailbox *mailbox, time_t expunge_mar
         dirty = 1;
 
         numdeleted++;
+        numunlinked++;
 
         struct index_record copyrecord = *record;
-        copyrecord.system_flags |= FLAG_UNLINKED;
+        copyrecord.system_flags |= FLAG_UNLINKED | FLAG_NEEDS_CLEANUP;
         copyrecord.silent = 1;
         if (mailbox_rewrite_index_record(mailbox, &copyrecord)) {
             syslog(LOG_ERR, "IOERROR: failed to mark unlinked %s %u (recno %d)",
@@ -4539,8 +4635,14 @@ EXPORTED int mailbox_expunge_cleanup(struct mailbox *mailbox, time_t expunge_mar
 
     if (dirty) {
         mailbox_index_dirty(mailbox);
-        mailbox->i.options |= OPT_MAILBOX_NEEDS_REPACK;
         mailbox->i.first_expunged = first_expunged;
+
+        /* the message files still get unlinked either way */
+        if (mailbox_repack_worthwhile(mailbox, numunlinked))
+            mailbox->i.options |= OPT_MAILBOX_NEEDS_REPACK;
+        else
+            syslog(LOG_INFO, "Deferring repack of %s: %u of %u records unlinked",
+                   mailbox->name, numunlinked, mailbox->i.num_records);
     }
 
     if (ndeleted) *ndeleted = numdeleted;
@@ -664,6 +664,12 @@ extern const message_t *mailbox_iter_step(struct mailbox_iter *iter);
 extern void mailbox_iter_done(struct mailbox_iter **iterp);
 
 struct synccrcs mailbox_synccrcs(struct mailbox *mailbox, int recalc);
+extern int mailbox_synccrcs_range(struct mailbox *mailbox,
+                                  uint32_t minuid, uint32_t maxuid,
+                                  unsigned n, struct synccrcs *crcs);
+extern void mailbox_synccrcs_slice(uint32_t minuid, uint32_t maxuid,
+                                   unsigned n, unsigned i,
+                                   uint32_t *lowp, uint32_t *highp);
 
 extern int mailbox_add_dav(struct mailbox *mailbox);
 
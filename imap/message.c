@@ -80,6 +80,7 @@
 #include "retry.h"
 #include "rfc822tok.h"
 #include "times.h"
+#include "xstats.h"
 
 /* generated headers are not necessarily in current directory */
 #include "imap/imap_err.h"
@@ -235,6 +236,7 @@ EXPORTED int message_copy_strict(struct protstream *from, FILE *to,
         }
 
         fwrite(buf, 1, n, to);
+        xstats_add(SPOOL_WRITE_BYTES, n);
     }
 
     if (r) return r;
@@ -376,6 +378,8 @@ EXPORTED int message_parse_binary_file(FILE *infile, struct body **body)
         return IMAP_IOERROR;
     }
 
+    xstats_inc(MESSAGE_PARSE);
+
     if (!*body) *body = (struct body *) xzmalloc(sizeof(struct body));
     message_parse_body(&msg, *body,
                        DEFAULT_CONTENT_TYPE, (strarray_t *)0);
@@ -405,6 +409,8 @@ EXPORTED int message_parse_mapped(const char *msg_base, unsigned long msg_len,
 {
     struct msg msg;
 
+    xstats_inc(MESSAGE_PARSE);
+
     msg.base = msg_base;
     msg.len = msg_len;
     msg.offset = 0;
@@ -1669,6 +1675,19 @@ static void message_parse_multipart(struct msg *msg, struct body *body,
     }
 }
 
+/* count the LFs in @len bytes at @s */
+static unsigned long message_count_lines(const char *s, size_t len)
+{
+    unsigned long n = 0;
+    size_t i;
+
+    /* simple enough for the compiler to vectorise */
+    for (i = 0; i < len; i++)
+        n += (s[i] == '\n');
+
+    return n;
+}
+
 /*
  * Parse the content of a generic body-part
  */
@@ -1686,6 +1705,22 @@ static void message_parse_content(struct msg *msg, struct body *body,
 
     while (msg->offset < msg->len) {
         line = msg->base + msg->offset;
+
+        if (!encode && !(line[0] == '-' && line[1] == '-')) {
+            /* Only a line starting with "--" can be a boundary, so
+             * everything up to the next one is content and we just
+             * need to count its lines */
+            size_t left = msg->len - msg->offset;
+            const char *next = boundaries->count ?
+                memmem(line, left, "\n--", 3) : NULL;
+            size_t skip = next ? (size_t) (next + 1 - line) : left;
+
+            msg->offset += skip;
+            body->content_size += skip;
+            body->content_lines += message_count_lines(line, skip);
+            continue;
+        }
+
         endline = memchr(line, '\n', msg->len - msg->offset);
         if (endline) {
             endline++;
@@ -1800,13 +1835,15 @@ static void message_parse_received_date(const char *hdr, char **hdrp)
 static char *message_getline(struct buf *buf, struct msg *msg)
 {
     unsigned int oldlen = buf_len(buf);
-    int c;
 
-    while (msg->offset < msg->len) {
-        c = msg->base[msg->offset++];
-        buf_putc(buf, c);
-        if (c == '\n')
-            break;
+    if (msg->offset < msg->len) {
+        const char *line = msg->base + msg->offset;
+        const char *endline = memchr(line, '\n', msg->len - msg->offset);
+        size_t len = endline ? (size_t) (endline + 1 - line)
+                             : msg->len - msg->offset;
+
+        buf_appendmap(buf, line, len);
+        msg->offset += len;
     }
     buf_cstring(buf);
 
@@ -2539,7 +2576,7 @@ EXPORTED void message_free_body(struct body *body)
  * When inside a list (ncom > 0), we parse the individual tokens but don't
  * isolate them -- we return the entire list as a single token.
  */
-HIDDEN void parse_cached_envelope(char *env, char *tokens[], int tokens_size)
+EXPORTED void parse_cached_envelope(char *env, char *tokens[], int tokens_size)
 {
     char *c;
     int i = 0, ncom = 0, len;
@@ -3620,6 +3657,31 @@ EXPORTED void message_unref(message_t **mp)
 
 /*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
 
+/*
+ * Tokenise the cached envelope of @record, returning a single
+ * allocation holding NUMENVTOKENS token pointers followed by the
+ * working copy of the envelope which they point into.
+ */
+static char **message_tokenise_envelope(const struct index_record *record)
+{
+    size_t size = cacheitem_size(record, CACHE_ENVELOPE);
+    char **tokens;
+    char *env;
+
+    /* strip outer ()'s, leaving space for NUL */
+    size = size > 2 ? size - 2 : 0;
+    tokens = xzmalloc(NUMENVTOKENS * sizeof(char *) + size + 1);
+    env = (char *)(tokens + NUMENVTOKENS);
+
+    if (size) {
+        /* +1 -> skip the leading paren */
+        memcpy(env, cacheitem_base(record, CACHE_ENVELOPE) + 1, size);
+        parse_cached_envelope(env, tokens, NUMENVTOKENS);
+    }
+
+    return tokens;
+}
+
 /*
  * Open or create resources which we need but do not yet have.
  */
@@ -3673,6 +3735,13 @@ static int message_need(const message_t *cm, unsigned int need)
         found(M_CACHE);
     }
 
+    if (is_missing(M_CENVELOPE)) {
+        r = message_need(m, M_CACHE);
+        if (r) return r;
+        m->envelope = message_tokenise_envelope(&m->record);
+        found(M_CENVELOPE);
+    }
+
     if (is_missing(M_CACHEBODY)) {
         if (message_need(m, M_CACHE) == 0) {
             r = message_parse_cbodystructure(m);
@@ -3728,6 +3797,12 @@ static void message_yield(message_t *m, unsigned int yield)
         m->have &= ~M_BODY;
     }
 
+    if ((yield & M_CENVELOPE)) {
+        free(m->envelope);
+        m->envelope = NULL;
+        m->have &= ~M_CENVELOPE;
+    }
+
     /* Check we yielded everything we could */
     assert((yield & m->have) == 0);
 }
@@ -4364,6 +4439,21 @@ EXPORTED int message_get_mailinglist(message_t *m, struct buf *buf)
     return message_get_field(m, "mailing-list", MESSAGE_RAW, buf);
 }
 
+/* Token @token (one of ENV_*) of the cached envelope, or NULL for NIL.
+ * The envelope is only tokenised once per message_t. */
+EXPORTED int message_get_envtoken(message_t *m, int token, const char **valp)
+{
+    int r;
+
+    if (token < 0 || token >= NUMENVTOKENS) return IMAP_INTERNAL;
+
+    r = message_need(m, M_CENVELOPE);
+    if (r) return r;
+
+    *valp = m->envelope[token];
+    return 0;
+}
+
 EXPORTED const struct index_record *msg_record(const message_t *m)
 {
     assert(!message_need(m, M_RECORD))
@@ -4660,16 +4750,10 @@ EXPORTED int message_get_field(message_t *m, const char *hdr, int flags, struct
 
     /* message-id is from the envelope */
     else if (!strcasecmp(hdr, "message-id")) {
-        char *envtokens[NUMENVTOKENS];
-        char *c_env;
-        int r = message_need(m, M_CACHE);
+        int r = message_need(m, M_CENVELOPE);
         if (r) return r;
-        c_env = xstrndup(cacheitem_base(&m->record, CACHE_ENVELOPE) + 1,
-                         cacheitem_size(&m->record, CACHE_ENVELOPE) - 2);
-        parse_cached_envelope(c_env, envtokens, NUMENVTOKENS);
-        if (envtokens[ENV_MSGID])
-            buf_appendcstr(&raw, envtokens[ENV_MSGID]);
-        free(c_env);
+        if (m->envelope[ENV_MSGID])
+            buf_appendcstr(&raw, m->envelope[ENV_MSGID]);
         if (raw.len == 3 && raw.s[0] == 'N' && raw.s[1] == 'I' && raw.s[2] == 'L')
             buf_reset(&raw);
         hasname = 0;
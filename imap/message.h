@@ -279,6 +279,7 @@ extern int message_get_num_parts(message_t *m, unsigned int *np);
 extern int message_get_messageid(message_t *m, struct buf *buf);
 extern int message_get_listid(message_t *m, struct buf *buf);
 extern int message_get_mailinglist(message_t *m, struct buf *buf);
+extern int message_get_envtoken(message_t *m, int token, const char **valp);
 extern int message_get_from(message_t *m, struct buf *buf);
 extern int message_get_to(message_t *m, struct buf *buf);
 extern int message_get_cc(message_t *m, struct buf *buf);
@@ -77,6 +77,7 @@
 #include "assert.h"
 #include "exitcodes.h"
 #include "global.h"
+#include "hash.h"
 #include "mailbox.h"
 #include "mboxlist.h"
 #include "mpool.h"
@@ -146,6 +147,7 @@ struct conn {
     pthread_mutex_t m;
     struct pending *plist;
     struct pending *ptail;
+    struct hash_table pset;     /* mailboxes already in plist */
     struct conn *updatelist_next;
     struct prot_waitevent *ev; /* invoked every 'update_wait' seconds
                                   to send out updates */
@@ -198,6 +200,21 @@ static int conn_pipe[2];
 static pthread_mutex_t mailboxes_mutex = PTHREAD_MUTEX_INITIALIZER;
 static struct conn *updatelist = NULL;
 
+/* In-memory index of mailboxes.db entries, filled on demand.
+ *
+ * FIND (and every streamed update, which is answered like a FIND) reads
+ * from here under a shared lock, so lookups don't queue behind a SET
+ * that is holding mailboxes_mutex while it writes to disk.  Entries are
+ * never modified in place: writers replace them while holding both
+ * mailboxes_mutex and the exclusive lock, and readers take a copy.
+ * Mailboxes known not to exist are cached with t == SET_DELETE. */
+#define MBINDEX_SIZE  (64*1024)
+#define MBINDEX_MAX   (1024*1024)
+
+static pthread_rwlock_t mbindex_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct hash_table mbindex = HASH_TABLE_INITIALIZER;
+static unsigned mbindex_count = 0;
+
 /* --- prototypes --- */
 static void conn_free(struct conn *C);
 static mupdate_docmd_result_t docmd(struct conn *c);
@@ -383,6 +400,13 @@ static void conn_free(struct conn *C)
 
     if (C->streaming_hosts) strarray_free(C->streaming_hosts);
 
+    while (C->plist) {
+        struct pending *p = C->plist;
+        C->plist = p->next;
+        free(p);
+    }
+    if (C->pset.size) free_hash_table(&C->pset, NULL);
+
     free(C);
 }
 
@@ -1379,9 +1403,87 @@ static void *thread_main(void *rock __attribute__((unused)))
 static void database_init(void)
 {
     pthread_mutex_lock(&mailboxes_mutex); /* LOCK */
+    pthread_rwlock_wrlock(&mbindex_lock);
+    construct_hash_table(&mbindex, MBINDEX_SIZE, 0);
+    pthread_rwlock_unlock(&mbindex_lock);
     pthread_mutex_unlock(&mailboxes_mutex); /* UNLOCK */
 }
 
+static void free_mbent_cb(void *p)
+{
+    free_mbent((struct mbent *) p);
+}
+
+/* make a malloc'd copy of an mbent (which may be mpool'd) */
+static struct mbent *mbent_copy(const struct mbent *m)
+{
+    struct mbent *out;
+
+    if (!m) return NULL;
+
+    out = xmalloc(sizeof(struct mbent) + strlen(m->acl));
+    out->mailbox = xstrdup(m->mailbox);
+    out->location = xstrdup(m->location);
+    out->t = m->t;
+    out->next = NULL;
+    strcpy(out->acl, m->acl);
+
+    return out;
+}
+
+/* record the current database state of 'name' in the index.
+ * 'm' is the entry as written to disk, NULL or SET_DELETE if the
+ * mailbox doesn't exist.  caller MUST hold mailboxes_mutex */
+static void mbindex_store(const char *name, const struct mbent *m)
+{
+    struct mbent *new, *old;
+
+    if (m && m->t != SET_DELETE) {
+        new = mbent_copy(m);
+    }
+    else {
+        new = xzmalloc(sizeof(struct mbent));
+        new->mailbox = xstrdup(name);
+        new->location = xstrdup("");
+        new->t = SET_DELETE;
+    }
+
+    pthread_rwlock_wrlock(&mbindex_lock);
+
+    if (!mbindex.size) {
+        /* index not (yet) in use */
+        pthread_rwlock_unlock(&mbindex_lock);
+        free_mbent(new);
+        return;
+    }
+
+    if (mbindex_count >= MBINDEX_MAX) {
+        /* don't grow without bound; start afresh */
+        free_hash_table(&mbindex, free_mbent_cb);
+        construct_hash_table(&mbindex, MBINDEX_SIZE, 0);
+        mbindex_count = 0;
+    }
+
+    old = hash_insert(name, new, &mbindex);
+    if (old == new) mbindex_count++;
+    else free_mbent(old);
+
+    pthread_rwlock_unlock(&mbindex_lock);
+}
+
+/* forget everything, e.g. after a bulk change of the database.
+ * caller MUST hold mailboxes_mutex */
+static void mbindex_clear(void)
+{
+    pthread_rwlock_wrlock(&mbindex_lock);
+    if (mbindex.size) {
+        free_hash_table(&mbindex, free_mbent_cb);
+        construct_hash_table(&mbindex, MBINDEX_SIZE, 0);
+    }
+    mbindex_count = 0;
+    pthread_rwlock_unlock(&mbindex_lock);
+}
+
 /* log change to database. database must be locked. */
 static void database_log(const struct mbent *mb, struct txn **mytid)
 {
@@ -1479,6 +1581,37 @@ static struct mbent *database_lookup(const char *name, const mbentry_t *mbentry,
     return out;
 }
 
+/* lookup via the index, falling back to the database (and filling the
+ * index) on a miss.  returns a malloc'd mbent, or NULL if the mailbox
+ * doesn't exist.  caller MUST NOT hold mailboxes_mutex */
+static struct mbent *mbindex_lookup(const char *name)
+{
+    struct mbent *m = NULL;
+    int found = 0;
+
+    if (!name) return NULL;
+
+    pthread_rwlock_rdlock(&mbindex_lock);
+    if (mbindex.size) {
+        struct mbent *cached = hash_lookup(name, &mbindex);
+
+        if (cached) {
+            found = 1;
+            if (cached->t != SET_DELETE) m = mbent_copy(cached);
+        }
+    }
+    pthread_rwlock_unlock(&mbindex_lock);
+
+    if (!found) {
+        pthread_mutex_lock(&mailboxes_mutex); /* LOCK */
+        m = database_lookup(name, NULL, NULL);
+        mbindex_store(name, m);
+        pthread_mutex_unlock(&mailboxes_mutex); /* UNLOCK */
+    }
+
+    return m;
+}
+
 static void cmd_authenticate(struct conn *C,
                       const char *tag, const char *mech,
                       const char *clientstart)
@@ -1558,9 +1691,7 @@ static void log_update(const char *mailbox,
 
     for (upc = updatelist; upc != NULL; upc = upc->updatelist_next) {
         /* for each connection, add to pending list */
-        struct pending *p = (struct pending *) xmalloc(sizeof(struct pending));
-        p->next = NULL;
-        strlcpy(p->mailbox, mailbox, sizeof(p->mailbox));
+        struct pending *p;
 
         /* this might need to be inside the mutex, but I doubt it */
         if (upc->streaming_hosts
@@ -1574,6 +1705,22 @@ static void log_update(const char *mailbox,
 
         pthread_mutex_lock(&upc->m);
 
+        /* updates are sent as the mailbox's state at send time, so one
+         * pending entry per mailbox is enough; this also bounds the
+         * queue by the number of distinct mailboxes changed */
+        if (!upc->pset.size) {
+            construct_hash_table(&upc->pset, 4096, 0);
+        }
+        else if (hash_lookup(mailbox, &upc->pset)) {
+            pthread_mutex_unlock(&upc->m);
+            continue;
+        }
+        hash_insert(mailbox, (void *) 1, &upc->pset);
+
+        p = (struct pending *) xmalloc(sizeof(struct pending));
+        p->next = NULL;
+        strlcpy(p->mailbox, mailbox, sizeof(p->mailbox));
+
         if ( upc->plist == NULL ) {
             upc->plist = upc->ptail = p;
         } else {
@@ -1697,6 +1844,8 @@ static void cmd_set(struct conn *C,
     /* write to disk */
     if (m) database_log(m, NULL);
 
+    mbindex_store(mailbox, m);
+
     if (oldlocation) {
         tmp = strchr(oldlocation, '!');
         if (tmp) *tmp = '\0';
@@ -1746,12 +1895,10 @@ static void cmd_find(struct conn *C, const char *tag, const char *mailbox,
 
     syslog(LOG_DEBUG, "cmd_find(fd:%d, %s)", C->fd, mailbox);
 
-    /* Only hold the mutex around database_lookup,
-     * since the mbent stays valid even if the database changes,
-     * and we don't want to block on network I/O */
-    pthread_mutex_lock(&mailboxes_mutex); /* LOCK */
-    m = database_lookup(mailbox, NULL, NULL);
-    pthread_mutex_unlock(&mailboxes_mutex); /* UNLOCK */
+    /* The mbent is our own copy, so it stays valid even if the
+     * database changes, and we don't block on network I/O
+     * while holding any lock */
+    m = mbindex_lookup(mailbox);
 
     if (m && m->t == SET_ACTIVE) {
         prot_printf(C->pout,
@@ -1936,6 +2083,11 @@ static void sendupdates(struct conn *C, int flushnow)
     p = C->plist;
     C->plist = NULL;
     C->ptail = NULL;
+    if (p) {
+        /* later changes must queue the mailbox again */
+        free_hash_table(&C->pset, NULL);
+        construct_hash_table(&C->pset, 4096, 0);
+    }
     pthread_mutex_unlock(&C->m);
 
     while (p != NULL) {
@@ -2199,6 +2351,7 @@ int cmd_change(struct mupdate_mailboxdata *mdata,
 
     /* write to disk */
     database_log(m, NULL);
+    mbindex_store(mdata->mailbox, m);
 
     if (oldlocation) {
         tmp = strchr(oldlocation, '!');
@@ -2483,6 +2636,9 @@ int mupdate_synchronize(struct mbent_queue *remote_boxes, struct mpool *pool)
 
     if (tid) mboxlist_commit(tid);
 
+    /* the index no longer reflects the database */
+    mbindex_clear();
+
     /* All up to date! */
     if ( err ) {
         syslog(LOG_ERR, "mailbox list synchronization NOT complete (%d) errors",
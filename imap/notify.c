@@ -44,10 +44,12 @@
 #include <config.h>
 #endif
 
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <syslog.h>
 #include <sys/mman.h>
+#include <sys/poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -70,6 +72,24 @@
 
 #define FNAME_NOTIFY_SOCK "/socket/notify"
 
+/* how long (in ms) to wait for a congested notifyd before dropping */
+#define NOTIFY_SEND_TIMEOUT 100
+
+/*
+ * The notification sockets are kept open for the life of the process,
+ * rather than being set up and torn down for every event, which
+ * matters when a single command generates many of them.
+ */
+static int notify_soc = -1;
+static unsigned notify_bufsiz = 0;
+
+/* notifications dropped because notifyd wasn't keeping up */
+static unsigned long notify_dropped = 0;
+static time_t notify_dropped_logged = 0;
+
+static int dlist_soc = -1;
+static struct protstream *dlist_in = NULL, *dlist_out = NULL;
+
 static int add_arg(char *buf, int max_size, const char *arg, int *buflen)
 {
     const char *myarg = (arg ? arg : "");
@@ -83,19 +103,64 @@ static int add_arg(char *buf, int max_size, const char *arg, int *buflen)
     return 0;
 }
 
+static void dlist_disconnect(void)
+{
+    if (dlist_in) prot_free(dlist_in);
+    if (dlist_out) prot_free(dlist_out);
+    if (dlist_soc >= 0) close(dlist_soc);
+    dlist_in = dlist_out = NULL;
+    dlist_soc = -1;
+}
+
+static int dlist_connect(const char *sockpath)
+{
+    struct sockaddr_un sun_data;
+
+    if (dlist_soc >= 0) {
+        struct pollfd pfd = { dlist_soc, POLLIN, 0 };
+
+        /* nothing should be waiting to be read between requests;
+           if anything is (most likely EOF), the peer is done with us */
+        if (poll(&pfd, 1, 0) == 0) return 0;
+
+        dlist_disconnect();
+    }
+
+    memset((char *)&sun_data, 0, sizeof(sun_data));
+    sun_data.sun_family = AF_UNIX;
+    strlcpy(sun_data.sun_path, sockpath, sizeof(sun_data.sun_path));
+
+    dlist_soc = socket(PF_UNIX, SOCK_STREAM, 0);
+    if (dlist_soc < 0) {
+        syslog(LOG_ERR, "NOTIFY: unable to create notify socket(): %m");
+        return -1;
+    }
+
+    if (connect(dlist_soc, (struct sockaddr *)&sun_data, sizeof(sun_data)) < 0) {
+        syslog(LOG_ERR, "NOTIFY: failed to connect to %s: %m", sockpath);
+        dlist_disconnect();
+        return -1;
+    }
+
+    dlist_in = prot_new(dlist_soc, 0);
+    dlist_out = prot_new(dlist_soc, 1);
+    /* Force use of LITERAL+ */
+    prot_setisclient(dlist_in, 1);
+    prot_setisclient(dlist_out, 1);
+
+    return 0;
+}
+
 static void notify_dlist(const char *sockpath, const char *method,
                          const char *class, const char *priority,
                          const char *user, const char *mailbox,
                          int nopt, const char **options,
                          const char *message, const char *fname)
 {
-    struct sockaddr_un sun_data;
-    struct protstream *in = NULL, *out = NULL;
     struct dlist *dl = dlist_newkvlist(NULL, "NOTIFY");
     struct dlist *res = NULL;
     struct dlist *il;
     int c;
-    int soc = -1;
     int i;
 
     dlist_setatom(dl, "METHOD", method);
@@ -109,45 +174,24 @@ static void notify_dlist(const char *sockpath, const char *method,
     dlist_setatom(dl, "MESSAGE", message);
     dlist_setatom(dl, "FILEPATH", fname);
 
-    memset((char *)&sun_data, 0, sizeof(sun_data));
-    sun_data.sun_family = AF_UNIX;
-    strlcpy(sun_data.sun_path, sockpath, sizeof(sun_data.sun_path));
+    if (dlist_connect(sockpath)) goto out;
 
-    soc = socket(PF_UNIX, SOCK_STREAM, 0);
-    if (soc < 0) {
-        syslog(LOG_ERR, "NOTIFY: unable to create notify socket(): %m");
-        goto out;
-    }
+    dlist_print(dl, 1, dlist_out);
+    prot_printf(dlist_out, "\r\n");
+    prot_flush(dlist_out);
 
-    if (connect(soc, (struct sockaddr *)&sun_data, sizeof(sun_data)) < 0) {
-        syslog(LOG_ERR, "NOTIFY: failed to connect to %s: %m", sockpath);
-        goto out;
-    }
-
-    in = prot_new(soc, 0);
-    out = prot_new(soc, 1);
-    /* Force use of LITERAL+ */
-    prot_setisclient(in, 1);
-    prot_setisclient(out, 1);
-
-    dlist_print(dl, 1, out);
-    prot_printf(out, "\r\n");
-    prot_flush(out);
-
-    c = dlist_parse(&res, 1, 0, in);
-    if (c == '\r') c = prot_getc(in);
+    c = dlist_parse(&res, 1, 0, dlist_in);
+    if (c == '\r') c = prot_getc(dlist_in);
     /* XXX - do something with the response?  Like have NOTIFY answer */
     if (c == '\n' && res && res->name) {
         syslog(LOG_NOTICE, "NOTIFY: response %s to method %s", res->name, method);
     }
     else {
         syslog(LOG_ERR, "NOTIFY: error sending %s to %s", method, sockpath);
+        dlist_disconnect();
     }
 
 out:
-    if (in) prot_free(in);
-    if (out) prot_free(out);
-    if (soc >= 0) close(soc);
     dlist_free(&dl);
     dlist_free(&res);
 }
@@ -224,32 +268,19 @@ done:
     return r;
 }
 
-EXPORTED void notify(const char *method,
-            const char *class, const char *priority,
-            const char *user, const char *mailbox,
-            int nopt, const char **options,
-            const char *message, const char *fname)
+/* open and connect the datagram socket to notifyd, if not already done */
+static int notify_connect(const char *notify_sock)
 {
-    const char *notify_sock = config_getstring(IMAPOPT_NOTIFYSOCKET);
-    int soc = -1;
     struct sockaddr_un sun_data;
-    char buf[NOTIFY_MAXSIZE] = "", noptstr[20];
-    int buflen = 0;
-    int i, r = 0;
     unsigned bufsiz;
     socklen_t optlen;
 
-    if (!strncmp(notify_sock, "dlist:", 6)) {
-        notify_dlist(notify_sock+6, method, class, priority,
-                            user, mailbox, nopt, options,
-                            message, fname);
-        return;
-    }
+    if (notify_soc >= 0) return 0;
 
-    soc = socket(AF_UNIX, SOCK_DGRAM, 0);
-    if (soc == -1) {
+    notify_soc = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (notify_soc == -1) {
         syslog(LOG_ERR, "unable to create notify socket(): %m");
-        goto out;
+        return -1;
     }
 
     memset((char *)&sun_data, 0, sizeof(sun_data));
@@ -265,14 +296,106 @@ EXPORTED void notify(const char *method,
 
     /* Get send buffer size */
     optlen = sizeof(bufsiz);
-    r = getsockopt(soc, SOL_SOCKET, SO_SNDBUF, &bufsiz, &optlen);
-    if (r == -1) {
+    if (getsockopt(notify_soc, SOL_SOCKET, SO_SNDBUF, &bufsiz, &optlen) == -1) {
         syslog(LOG_ERR, "unable to getsockopt(SO_SNDBUF) on notify socket: %m");
-        goto out;
+        goto fail;
     }
 
     /* Use minimum of 1/10 of send buffer size (-overhead) NOTIFY_MAXSIZE */
-    bufsiz = MIN(bufsiz / 10 - 32, NOTIFY_MAXSIZE);
+    notify_bufsiz = MIN(bufsiz / 10 - 32, NOTIFY_MAXSIZE);
+
+    /* a connected socket lets us wait for room in notifyd's queue */
+    if (connect(notify_soc, (struct sockaddr *)&sun_data, sizeof(sun_data)) == -1) {
+        syslog(LOG_ERR, "unable to connect() notify socket: %m");
+        goto fail;
+    }
+
+    return 0;
+
+ fail:
+    xclose(notify_soc);
+    return -1;
+}
+
+static void notify_drop(void)
+{
+    time_t now = time(NULL);
+
+    notify_dropped++;
+
+    /* don't flood the log while notifyd is backed up */
+    if (now - notify_dropped_logged >= 60) {
+        syslog(LOG_WARNING, "notifyd is not keeping up: "
+               "%lu notifications dropped so far", notify_dropped);
+        notify_dropped_logged = now;
+    }
+}
+
+static void notify_send(const char *notify_sock, const char *buf, int buflen)
+{
+    int flags = 0;
+    int retry = 1;
+    ssize_t r;
+
+#ifdef MSG_DONTWAIT
+    flags |= MSG_DONTWAIT;
+#endif
+
+ again:
+    r = send(notify_soc, buf, buflen, flags);
+
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) {
+        /* notifyd's queue is full: give it a moment, then give up
+           rather than stalling the command that caused the event */
+        struct pollfd pfd = { notify_soc, POLLOUT, 0 };
+
+        if (poll(&pfd, 1, NOTIFY_SEND_TIMEOUT) > 0)
+            r = send(notify_soc, buf, buflen, flags);
+
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) {
+            notify_drop();
+            return;
+        }
+    }
+
+    if (r < 0 && retry) {
+        /* notifyd may have been restarted; reconnect and try once more */
+        retry = 0;
+        xclose(notify_soc);
+        if (!notify_connect(notify_sock)) goto again;
+        return;
+    }
+
+    if (r < 0) {
+        syslog(LOG_ERR, "unable to send() to notify socket: %m");
+        xclose(notify_soc);
+    }
+    else if (r < buflen) {
+        syslog(LOG_ERR, "short write to notify socket");
+    }
+}
+
+EXPORTED void notify(const char *method,
+            const char *class, const char *priority,
+            const char *user, const char *mailbox,
+            int nopt, const char **options,
+            const char *message, const char *fname)
+{
+    const char *notify_sock = config_getstring(IMAPOPT_NOTIFYSOCKET);
+    char buf[NOTIFY_MAXSIZE] = "", noptstr[20];
+    int buflen = 0;
+    int i, r = 0;
+    unsigned bufsiz;
+
+    if (!strncmp(notify_sock, "dlist:", 6)) {
+        notify_dlist(notify_sock+6, method, class, priority,
+                            user, mailbox, nopt, options,
+                            message, fname);
+        return;
+    }
+
+    if (notify_connect(notify_sock)) return;
+    bufsiz = notify_bufsiz;
 
     /*
      * build request of the form:
@@ -300,21 +423,8 @@ EXPORTED void notify(const char *method,
     if (r) {
         syslog(LOG_ERR, "notify datagram too large, %s, %s",
                user, mailbox);
-        goto out;
-    }
-
-    r = sendto(soc, buf, buflen, 0,
-               (struct sockaddr *)&sun_data, sizeof(sun_data));
-
-    if (r < 0) {
-        syslog(LOG_ERR, "unable to sendto() notify socket: %m");
-        goto out;
-    }
-    if (r < buflen) {
-        syslog(LOG_ERR, "short write to notify socket");
-        goto out;
+        return;
     }
 
-out:
-    xclose(soc);
+    notify_send(notify_sock, buf, buflen);
 }
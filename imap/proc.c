@@ -244,6 +244,14 @@ done:
     return r;
 }
 
+/*
+ * Call 'func' for process 'pid', if it has registered itself.
+ */
+EXPORTED int proc_lookup(pid_t pid, procdata_t *func, void *rock)
+{
+    return proc_foreach_helper(pid, func, rock);
+}
+
 EXPORTED int proc_foreach(procdata_t *func, void *rock)
 {
     DIR *dirp;
@@ -67,6 +67,7 @@ extern int proc_register(const char *servicename, const char *clienthost,
 extern void proc_cleanup(void);
 
 extern int proc_foreach(procdata_t *func, void *rock);
+extern int proc_lookup(pid_t pid, procdata_t *func, void *rock);
 
 extern int proc_checklimits(struct proc_limits *limitsp);
 
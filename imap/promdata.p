@@ -1,7 +1,7 @@
 # Prometheus metric definitions file
 #
 # metric <type> <name> <description>
-#   * type is one of "counter" or "gauge"
+#   * type is one of "counter", "gauge" or "histogram"
 #   * name must be [a-z0-9_] only
 #   * description is free text until EOL but don't be silly
 #
@@ -10,6 +10,11 @@
 #   * key must be [a-z0-9_] only
 #   * values must be [a-z0-9_] only and are whitespace delimited until EOL
 #
+# buckets <metric> <bounds...>
+#   * metric is the name of an already defined histogram
+#   * bounds are the increasing upper bounds of its buckets; +Inf is implied
+#   * without this, histograms get 0.005 0.01 0.025 0.05 0.1 0.25 0.5 1 2.5 5 10
+#
 # Each metric may have zero or one labels applied to it
 #
 # '#' begins a comment
@@ -65,6 +70,9 @@ metric counter cyrus_imap_thread_total                  The total number of IMAP
 metric counter cyrus_imap_unsubscribe_total             The total number of IMAP UNSUBSCRIBEs
 metric counter cyrus_imap_unselect_total                The total number of IMAP UNSELECTs
 metric counter cyrus_imap_xbackup_total                 The total number of IMAP XBACKUPs
+metric histogram cyrus_imap_command_duration_seconds    The time taken to process IMAP commands, and to push IDLE updates
+    label cyrus_imap_command_duration_seconds command append fetch idle search sort
+    buckets cyrus_imap_command_duration_seconds 0.001 0.0025 0.005 0.01 0.025 0.05 0.1 0.25 0.5 1 2.5 5 10 30
 
 metric counter cyrus_lmtp_connections_total             The total number of LMTP connections
 metric gauge   cyrus_lmtp_active_connections            The number of active LMTP connections
@@ -86,3 +94,17 @@ metric counter cyrus_lmtp_sieve_keep_total              The number of sieve KEEP
 metric counter cyrus_lmtp_sieve_notify_total            The number of sieve NOTIFYs
 metric counter cyrus_lmtp_sieve_autorespond_total       The number of sieve AUTORESPONDs considered
 metric counter cyrus_lmtp_sieve_autorespond_sent_total  The number of sieve AUTORESPONDs sent
+metric histogram cyrus_lmtp_delivery_duration_seconds   The time taken to deliver to each local recipient
+
+metric histogram cyrus_http_request_duration_seconds    The time taken to process HTTP requests
+    label cyrus_http_request_duration_seconds method acl bind copy delete get head lock mkcalendar mkcol move options patch post propfind proppatch put report trace unbind unlock
+
+metric histogram cyrus_sync_mailbox_duration_seconds    The time taken to replicate each mailbox
+    buckets cyrus_sync_mailbox_duration_seconds 0.01 0.025 0.05 0.1 0.25 0.5 1 2.5 5 10 30 60 300
+
+metric histogram cyrus_lock_wait_seconds                The time spent waiting to obtain file locks
+    label cyrus_lock_wait_seconds class index namelock database
+    buckets cyrus_lock_wait_seconds 0.0001 0.0005 0.001 0.005 0.01 0.05 0.1 0.5 1 5 10 30
+
+metric counter cyrus_tls_session_tickets_total          The number of TLS session tickets issued or presented
+    label cyrus_tls_session_tickets_total result issued resumed renewed unknown
@@ -46,6 +46,7 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <math.h>
 #include <string.h>
 #include <syslog.h>
 #include <time.h>
@@ -187,7 +188,9 @@ static void prometheus_done(void *rock __attribute__((unused)))
     r = mappedfile_writelock(doneprocs);
     if (r) goto done;
 
-    memcpy(&accum, mappedfile_base(doneprocs), mappedfile_size(doneprocs));
+    /* n.b. may be short (or long) if metrics were added since it was written */
+    memcpy(&accum, mappedfile_base(doneprocs),
+           MIN(mappedfile_size(doneprocs), sizeof(accum)));
     if (accum.pid == 0) accum.pid = (pid_t) -1;
 
     /* read stats from this process */
@@ -197,7 +200,8 @@ static void prometheus_done(void *rock __attribute__((unused)))
                         doneprocs_fname, error_message(r));
         goto done;
     }
-    memcpy(&thisproc, mappedfile_base(promhandle->mf), mappedfile_size(promhandle->mf));
+    memcpy(&thisproc, mappedfile_base(promhandle->mf),
+           MIN(mappedfile_size(promhandle->mf), sizeof(thisproc)));
     mappedfile_unlock(promhandle->mf);
 
     /* unlink per-process stats file, we don't need it anymore */
@@ -285,6 +289,104 @@ EXPORTED void prometheus_apply_delta(enum prom_metric_id metric_id,
     mappedfile_unlock(promhandle->mf);
 }
 
+/* A histogram occupies consecutive slots: one cumulative count per
+ * bucket (the last having an upper bound of +Inf), then _sum, then
+ * _count.  A batch is bucketed in memory, and all of its slots are
+ * updated under a single lock and write when it is flushed.
+ */
+EXPORTED void prometheus_batch_observe(struct prom_histogram_batch *batch,
+                                       double value)
+{
+    enum prom_metric_id metric_id = batch->metric_id;
+    int i;
+
+    assert(metric_id >= 0 && metric_id < PROM_NUM_METRICS);
+    assert(prom_metric_descs[metric_id].family != NULL);
+
+    for (i = 0; ; i++) {
+        assert(i < PROM_HISTOGRAM_MAX_BUCKETS);
+        assert(metric_id + i < PROM_NUM_METRICS);
+        if (value <= prom_metric_descs[metric_id + i].le)
+            batch->buckets[i]++;
+        if (isinf(prom_metric_descs[metric_id + i].le)) break;
+    }
+    batch->sum += value;
+    batch->count++;
+}
+
+EXPORTED void prometheus_batch_flush(struct prom_histogram_batch *batch)
+{
+    struct prom_metric metrics[PROM_HISTOGRAM_MAX_BUCKETS + 2];
+    enum prom_metric_id metric_id = batch->metric_id;
+    int64_t now;
+    size_t offset;
+    int i, nslots;
+    int r;
+
+    if (!batch->count) return;
+
+    if (!prometheus_enabled) goto done;
+
+    if (!promhandle) prometheus_init();
+
+    if (!prometheus_enabled) goto done;
+
+    for (nslots = 1; !isinf(prom_metric_descs[metric_id + nslots - 1].le); nslots++)
+        ;
+    nslots += 2; /* _sum and _count */
+
+    r = mappedfile_writelock(promhandle->mf);
+    if (r) {
+        syslog(LOG_ERR, "IOERROR: mappedfile_writelock unable to obtain lock on %s",
+                        mappedfile_fname(promhandle->mf));
+        goto done;
+    }
+
+    offset = offsetof(struct prom_stats, metrics) + metric_id * sizeof(metrics[0]);
+    memcpy(metrics, mappedfile_base(promhandle->mf) + offset,
+           nslots * sizeof(metrics[0]));
+
+    now = now_ms();
+    for (i = 0; i < nslots - 2; i++) {
+        if (batch->buckets[i]) {
+            metrics[i].value += batch->buckets[i];
+            metrics[i].last_updated = now;
+        }
+    }
+    metrics[nslots - 2].value += batch->sum;
+    metrics[nslots - 2].last_updated = now;
+    metrics[nslots - 1].value += batch->count;
+    metrics[nslots - 1].last_updated = now;
+
+    r = mappedfile_pwrite(promhandle->mf, metrics,
+                          nslots * sizeof(metrics[0]), offset);
+    if (r != (int) (nslots * sizeof(metrics[0]))) {
+        syslog(LOG_ERR, "IOERROR: mappedfile_pwrite: expected to write "
+                        SIZE_T_FMT " bytes, actually wrote %d",
+                        nslots * sizeof(metrics[0]), r);
+    }
+    else {
+        mappedfile_commit(promhandle->mf);
+    }
+
+    mappedfile_unlock(promhandle->mf);
+
+done:
+    memset(batch->buckets, 0, sizeof(batch->buckets));
+    batch->sum = 0;
+    batch->count = 0;
+}
+
+EXPORTED void prometheus_observe(enum prom_metric_id metric_id, double value)
+{
+    struct prom_histogram_batch batch = PROM_HISTOGRAM_BATCH_INITIALIZER(metric_id);
+
+    if (!prometheus_enabled) return;
+
+    prometheus_batch_observe(&batch, value);
+    prometheus_batch_flush(&batch);
+}
+
 EXPORTED int prometheus_text_report(struct buf *buf, const char **mimetype)
 {
     char *report_fname = NULL;
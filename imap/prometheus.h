@@ -67,6 +67,25 @@ extern const char *prometheus_stats_dir(void);
 extern void prometheus_apply_delta(enum prom_metric_id metric_id,
                                    double delta);
 
+/* record one observation (typically a duration in seconds) in the
+ * histogram identified by metric_id */
+extern void prometheus_observe(enum prom_metric_id metric_id, double value);
+
+/* observations held in memory and written out together, for callers
+ * too frequent to pay for a locked write each time */
+#define PROM_HISTOGRAM_MAX_BUCKETS 62
+struct prom_histogram_batch {
+    enum prom_metric_id metric_id;
+    uint64_t count;
+    double sum;
+    uint64_t buckets[PROM_HISTOGRAM_MAX_BUCKETS]; /* cumulative */
+};
+#define PROM_HISTOGRAM_BATCH_INITIALIZER(id) { (id), 0, 0.0, { 0 } }
+
+extern void prometheus_batch_observe(struct prom_histogram_batch *batch,
+                                     double value);
+extern void prometheus_batch_flush(struct prom_histogram_batch *batch);
+
 extern int prometheus_text_report(struct buf *buf, const char **mimetype);
 
 #endif
@@ -164,7 +164,9 @@ static int promdir_foreach(promdir_foreach_cb *proc, void *rock)
         if (r) continue;
         r = mappedfile_readlock(mf);
         if (!r) {
-            memcpy(&stats, mappedfile_base(mf), mappedfile_size(mf));
+            memset(&stats, 0, sizeof(stats));
+            memcpy(&stats, mappedfile_base(mf),
+                   MIN(mappedfile_size(mf), sizeof(stats)));
             mappedfile_unlock(mf);
         }
         mappedfile_close(&mf);
@@ -206,7 +208,8 @@ static void do_collate_report(struct buf *buf)
     mappedfile_open(&doneprocs_mf, doneprocs_fname, MAPPEDFILE_CREATE);
     free(doneprocs_fname);
     if (doneprocs_mf && 0 == mappedfile_readlock(doneprocs_mf)) {
-        memcpy(&doneprocs_stats, mappedfile_base(doneprocs_mf), mappedfile_size(doneprocs_mf));
+        memcpy(&doneprocs_stats, mappedfile_base(doneprocs_mf),
+               MIN(mappedfile_size(doneprocs_mf), sizeof(doneprocs_stats)));
         read_into_array(&doneprocs_stats, &proc_stats);
     }
 
@@ -222,15 +225,18 @@ static void do_collate_report(struct buf *buf)
 
     /* format it into buf */
     for (j = 0; j < PROM_NUM_METRICS; j++) {
+        const char *family = prom_metric_descs[j].family ?
+                             prom_metric_descs[j].family :
+                             prom_metric_descs[j].name;
         double sum = 0.0;
         int64_t last_updated = 0;
 
         if (prom_metric_descs[j].help) {
-            buf_printf(buf, "# HELP %s %s\n", prom_metric_descs[j].name,
+            buf_printf(buf, "# HELP %s %s\n", family,
                             prom_metric_descs[j].help);
         }
         if (prom_metric_descs[j].type != PROM_METRIC_CONTINUED) {
-            buf_printf(buf, "# TYPE %s %s\n", prom_metric_descs[j].name,
+            buf_printf(buf, "# TYPE %s %s\n", family,
                             prom_metric_type_names[prom_metric_descs[j].type]);
         }
 
@@ -246,7 +252,11 @@ static void do_collate_report(struct buf *buf)
         buf_appendcstr(buf, prom_metric_descs[j].name);
         if (prom_metric_descs[j].label)
             buf_printf(buf, "{%s}", prom_metric_descs[j].label);
-        buf_printf(buf, " %.0f %" PRId64 "\n", sum, last_updated);
+        /* only histogram sums are fractional */
+        if (sum == (double) (int64_t) sum)
+            buf_printf(buf, " %.0f %" PRId64 "\n", sum, last_updated);
+        else
+            buf_printf(buf, " %.6f %" PRId64 "\n", sum, last_updated);
     }
 
     /* clean up the copy */
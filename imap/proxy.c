@@ -176,16 +176,17 @@ EXPORTED struct backend * proxy_findserver(const char *server,          /* hostn
         /* need to (re)establish connection to server or create one */
         ret = backend_connect(ret, server, prot, userid, NULL, NULL, -1);
         if (!ret) return NULL;
+    }
 
-        if (clientin) {
-            /* add the timeout */
-            ret->clientin = clientin;
-            ret->timeout = prot_addwaitevent(clientin,
-                                             time(NULL) + IDLE_TIMEOUT,
-                                             backend_timeout, ret);
+    if (clientin && !ret->timeout) {
+        /* add the timeout (a reconnected or pooled backend may already
+           have one, or may have been detached from its previous client) */
+        ret->clientin = clientin;
+        ret->timeout = prot_addwaitevent(clientin,
+                                         time(NULL) + IDLE_TIMEOUT,
+                                         backend_timeout, ret);
 
-            ret->timeout->mark = time(NULL) + IDLE_TIMEOUT;
-        }
+        ret->timeout->mark = time(NULL) + IDLE_TIMEOUT;
     }
 
     ret->current = current;
@@ -73,6 +73,13 @@ extern int status_lookup_mailbox(struct mailbox *mailbox, const char *userid,
 extern int statuscache_lookup(const char *mboxname, const char *userid,
                               unsigned statusitems, struct statusdata *sdata);
 
+/* read ahead all of userid's entries for mboxname and its children,
+   to serve the many statuscache_lookup()s of a LIST-STATUS */
+extern void statuscache_prefetch(const char *mboxname, const char *userid);
+
+/* discard the read ahead entries */
+extern void statuscache_prefetch_done(void);
+
 /* invalidate (delete) statuscache entry for the mailbox,
    optionally writing the data for one user in the same transaction */
 extern int statuscache_invalidate(const char *mboxname,
@@ -58,6 +58,7 @@
 #include "cyrusdb.h"
 #include "imapd.h"
 #include "global.h"
+#include "hash.h"
 #include "mboxlist.h"
 #include "mailbox.h"
 #include "seen.h"
@@ -75,6 +76,9 @@
 static struct db *statuscachedb;
 static int statuscache_dbopen = 0;
 
+/* entries read ahead by statuscache_prefetch(), keyed like the db */
+static struct hash_table prefetch_table = HASH_TABLE_INITIALIZER;
+
 static void done_cb(void *rock __attribute__((unused))) {
     if (statuscache_dbopen) {
         statuscache_close();
@@ -125,6 +129,8 @@ EXPORTED void statuscache_close(void)
 {
     int r;
 
+    statuscache_prefetch_done();
+
     if (statuscache_dbopen) {
         r = cyrusdb_close(statuscachedb);
         if (r) {
@@ -380,27 +386,14 @@ EXPORTED int status_lookup_mailbox(struct mailbox *mailbox, const char *userid,
 
 
 
-EXPORTED int statuscache_lookup(const char *mboxname, const char *userid,
-                       unsigned statusitems, struct statusdata *sdata)
+static int statuscache_parse(const char *data, size_t datalen,
+                             unsigned statusitems, struct statusdata *sdata)
 {
-    size_t keylen, datalen;
-    int r = 0;
-    const char *data = NULL, *dend;
-    char *p, *key = statuscache_buildkey(mboxname, userid, &keylen);
+    const char *dend;
+    char *p;
     unsigned version;
 
-    init_internal();
-
-    /* Don't access DB if it hasn't been opened */
-    if (!statuscache_dbopen)
-        return IMAP_NO_NOSUCHMSG;
-
-    /* Check if there is an entry in the database */
-    do {
-        r = cyrusdb_fetch(statuscachedb, key, keylen, &data, &datalen, NULL);
-    } while (r == CYRUSDB_AGAIN);
-
-    if (r || !data || ((size_t) datalen < sizeof(unsigned))) {
+    if (!data || ((size_t) datalen < sizeof(unsigned))) {
         return IMAP_NO_NOSUCHMSG;
     }
 
@@ -433,6 +426,126 @@ EXPORTED int statuscache_lookup(const char *mboxname, const char *userid,
     return 0;
 }
 
+EXPORTED int statuscache_lookup(const char *mboxname, const char *userid,
+                       unsigned statusitems, struct statusdata *sdata)
+{
+    size_t keylen, datalen;
+    int r = 0;
+    const char *data = NULL;
+    char *key = statuscache_buildkey(mboxname, userid, &keylen);
+
+    init_internal();
+
+    /* Don't access DB if it hasn't been opened */
+    if (!statuscache_dbopen)
+        return IMAP_NO_NOSUCHMSG;
+
+    /* Use the read-ahead copy if we have one */
+    if (prefetch_table.size) {
+        struct buf *val = hash_lookup(key, &prefetch_table);
+
+        if (val && !statuscache_parse(val->s, val->len, statusitems, sdata))
+            return 0;
+    }
+
+    /* Check if there is an entry in the database */
+    do {
+        r = cyrusdb_fetch(statuscachedb, key, keylen, &data, &datalen, NULL);
+    } while (r == CYRUSDB_AGAIN);
+
+    if (r) return IMAP_NO_NOSUCHMSG;
+
+    return statuscache_parse(data, datalen, statusitems, sdata);
+}
+
+struct prefetch_rock {
+    const char *mboxprefix;
+    size_t mboxprefixlen;
+    const char *userid;
+};
+
+static int prefetch_p(void *rock,
+                      const char *key, size_t keylen,
+                      const char *data __attribute__((unused)),
+                      size_t datalen __attribute__((unused)))
+{
+    struct prefetch_rock *prock = (struct prefetch_rock *) rock;
+    const char *sep;
+
+    /* only the mailbox itself and its children, not user.foobar */
+    if (keylen < prock->mboxprefixlen + 2) return 0;
+    sep = key + prock->mboxprefixlen;
+    if (*sep != '%' && *sep != '.') return 0;
+
+    /* and only entries for this user */
+    sep = memchr(key, '%', keylen);
+    if (!sep || sep + 1 >= key + keylen || sep[1] != '%') return 0;
+    sep += 2;
+
+    return ((size_t) (key + keylen - sep) == strlen(prock->userid) &&
+            !memcmp(sep, prock->userid, key + keylen - sep));
+}
+
+static int prefetch_cb(void *rock __attribute__((unused)),
+                       const char *key, size_t keylen,
+                       const char *data, size_t datalen)
+{
+    struct buf *val = xzmalloc(sizeof(struct buf));
+    char *k = xstrndup(key, keylen);
+
+    buf_setmap(val, data, datalen);
+    buf_cstring(val);
+    hash_insert(k, val, &prefetch_table);
+    free(k);
+
+    return 0;
+}
+
+/*
+ * Read all of the entries that 'userid' has for 'mboxname' and its
+ * children in one pass over the database, for commands that are about
+ * to look up many of them (LIST-STATUS on a user's folders).  Lookups
+ * are served from this copy until statuscache_prefetch_done() is
+ * called, falling back to the database for anything not found.
+ * Changes made after the read ahead are not seen, so the caller must
+ * keep the window short, e.g. a single command.
+ */
+EXPORTED void statuscache_prefetch(const char *mboxname, const char *userid)
+{
+    struct prefetch_rock prock;
+    int r;
+
+    init_internal();
+
+    if (!statuscache_dbopen || !mboxname || !userid) return;
+
+    statuscache_prefetch_done();
+    construct_hash_table(&prefetch_table, 1024, 0);
+
+    prock.mboxprefix = mboxname;
+    prock.mboxprefixlen = strlen(mboxname);
+    prock.userid = userid;
+
+    r = cyrusdb_foreach(statuscachedb, mboxname, prock.mboxprefixlen,
+                        prefetch_p, prefetch_cb, &prock, NULL);
+    if (r) {
+        syslog(LOG_ERR, "DBERROR: error reading ahead statuscache for %s: %s",
+               mboxname, cyrusdb_strerror(r));
+        statuscache_prefetch_done();
+    }
+}
+
+static void free_prefetch(void *data)
+{
+    buf_destroy((struct buf *) data);
+}
+
+EXPORTED void statuscache_prefetch_done(void)
+{
+    if (prefetch_table.size)
+        free_hash_table(&prefetch_table, free_prefetch);
+}
+
 static int statuscache_store(const char *mboxname,
                              struct statusdata *sdata,
                              struct txn **tidptr)
@@ -49,6 +49,7 @@
 #include <stdio.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <syslog.h>
@@ -74,9 +75,12 @@
 #include "message.h"
 #include "util.h"
 #include "user.h"
+#include "prometheus.h"
 #include "prot.h"
 #include "dlist.h"
 #include "xstrlcat.h"
+#include "imparse.h"
+#include "sequence.h"
 
 #ifdef USE_CALALARMD
 #include "caldav_alarm.h"
@@ -1607,7 +1611,8 @@ static int sync_prepare_dlists(struct mailbox *mailbox,
                                const char *topart,
                                struct sync_msgid_list *part_list,
                                struct dlist *kl, struct dlist *kupload,
-                               int printrecords, int fullannots)
+                               int printrecords, int fullannots,
+                               struct seqset *uids)
 {
     struct sync_annot_list *annots = NULL;
     struct mailbox_iter *iter = NULL;
@@ -1677,6 +1682,10 @@ static int sync_prepare_dlists(struct mailbox *mailbox,
             const struct index_record *record = msg_record(msg);
             modseq_t since_modseq = fullannots ? 0 : modseq;
 
+            /* only the requested UID ranges */
+            if (uids && !seqset_ismember(uids, record->uid))
+                continue;
+
             /* stop early for partial sync */
             modseq_t mymodseq = record->modseq;
             if (ispartial) {
@@ -2937,7 +2946,7 @@ static int sync_mailbox_byname(const char *name, void *rock)
         sync_name_list_add(qrl, mailbox->quotaroot);
 
     r = sync_prepare_dlists(mailbox, NULL, NULL, NULL, NULL, kl, NULL, 0,
-                            /*XXX fullannots*/1);
+                            /*XXX fullannots*/1, NULL);
     if (!r) sync_send_response(kl, mrock->pout);
 
 out:
@@ -2956,23 +2965,88 @@ int sync_get_fullmailbox(struct dlist *kin, struct sync_state *sstate)
 {
     struct mailbox *mailbox = NULL;
     struct dlist *kl = dlist_newkvlist(NULL, "MAILBOX");
+    struct seqset *uids = NULL;
+    const char *mboxname = kin->sval;
     int r;
 
+    /* the kvlist form only sends records from the given UID ranges */
+    if (kin->type == DL_KVLIST) {
+        const char *seq = NULL;
+
+        if (!dlist_getatom(kin, "MBOXNAME", &mboxname) ||
+            !dlist_getatom(kin, "UIDS", &seq) ||
+            !imparse_issequence(seq)) {
+            r = IMAP_PROTOCOL_BAD_PARAMETERS;
+            goto out;
+        }
+        uids = seqset_parse(seq, NULL, UINT32_MAX);
+    }
+
     /* XXX again - this is a read-only request, but we
      * don't have a good way to express that, so we use
      * write locks anyway */
-    r = mailbox_open_iwl(kin->sval, &mailbox);
+    r = mailbox_open_iwl(mboxname, &mailbox);
     if (!r) r = sync_mailbox_version_check(&mailbox);
     if (r) goto out;
 
     r = sync_prepare_dlists(mailbox, NULL, NULL, NULL, NULL, kl, NULL, 1,
-                            /*XXX fullannots*/1);
+                            /*XXX fullannots*/1, uids);
+    if (r) goto out;
+
+    sync_send_response(kl, sstate->pout);
+
+out:
+    seqset_free(uids);
+    dlist_free(&kl);
+    mailbox_close(&mailbox);
+    return r;
+}
+
+/* largest number of slices a SYNCCRCS request may ask for */
+#define SYNC_CRC_MAXSPLIT 256
+
+int sync_get_synccrcs(struct dlist *kin, struct sync_state *sstate)
+{
+    struct mailbox *mailbox = NULL;
+    struct synccrcs *crcs = NULL;
+    struct dlist *kl = NULL, *kb, *ka;
+    const char *mboxname = NULL;
+    uint32_t minuid, maxuid, split;
+    unsigned i;
+    int r;
+
+    if (!dlist_getatom(kin, "MBOXNAME", &mboxname) ||
+        !dlist_getnum32(kin, "MINUID", &minuid) ||
+        !dlist_getnum32(kin, "MAXUID", &maxuid) ||
+        !dlist_getnum32(kin, "SPLIT", &split) ||
+        !split || split > SYNC_CRC_MAXSPLIT)
+        return IMAP_PROTOCOL_BAD_PARAMETERS;
+
+    /* XXX read-only, but the annotations need write locks, see above */
+    r = mailbox_open_iwl(mboxname, &mailbox);
+    if (!r) r = sync_mailbox_version_check(&mailbox);
+    if (r) goto out;
+
+    crcs = xmalloc(split * sizeof(struct synccrcs));
+    r = mailbox_synccrcs_range(mailbox, minuid, maxuid, split, crcs);
     if (r) goto out;
 
+    kl = dlist_newkvlist(NULL, "SYNCCRCS");
+    dlist_setatom(kl, "MBOXNAME", mailbox->name);
+    dlist_setnum32(kl, "MINUID", minuid);
+    dlist_setnum32(kl, "MAXUID", maxuid);
+    kb = dlist_newlist(kl, "BASIC");
+    ka = dlist_newlist(kl, "ANNOT");
+    for (i = 0; i < split; i++) {
+        dlist_setnum32(kb, "CRC", crcs[i].basic);
+        dlist_setnum32(ka, "CRC", crcs[i].annot);
+    }
+
     sync_send_response(kl, sstate->pout);
 
 out:
     dlist_free(&kl);
+    free(crcs);
     mailbox_close(&mailbox);
     return r;
 }
@@ -4888,13 +4962,28 @@ static int compare_one_record(struct mailbox *mailbox,
     return mailbox_rewrite_index_record(mailbox, mp);
 }
 
+/* the next local record, skipping any outside @uids if given */
+static const message_t *update_loop_step(struct mailbox_iter *iter,
+                                         struct seqset *uids)
+{
+    const message_t *msg;
+
+    while ((msg = mailbox_iter_step(iter))) {
+        if (!uids || seqset_ismember(uids, msg_record(msg)->uid))
+            break;
+    }
+
+    return msg;
+}
+
 static int mailbox_update_loop(struct mailbox *mailbox,
                                struct dlist *ki,
                                uint32_t last_uid,
                                modseq_t highestmodseq,
                                struct dlist *kaction,
                                struct sync_msgid_list *part_list,
-                               struct backend *sync_be)
+                               struct backend *sync_be,
+                               struct seqset *uids)
 {
     struct index_record rrecord;
     struct sync_annot_list *mannots = NULL;
@@ -4902,7 +4991,7 @@ static int mailbox_update_loop(struct mailbox *mailbox,
     int r;
 
     struct mailbox_iter *iter = mailbox_iter_init(mailbox, 0, 0);
-    const message_t *msg = mailbox_iter_step(iter);
+    const message_t *msg = update_loop_step(iter, uids);
     const struct index_record *mrecord = msg ? msg_record(msg) : NULL;
 
     /* while there are more records on either master OR replica,
@@ -4929,7 +5018,7 @@ static int mailbox_update_loop(struct mailbox *mailbox,
                                        sync_be);
                 if (r) goto out;
                 /* increment both */
-                msg = mailbox_iter_step(iter);
+                msg = update_loop_step(iter, uids);
                 mrecord = msg ? msg_record(msg) : NULL;
                 ki = ki->next;
             }
@@ -4943,7 +5032,7 @@ static int mailbox_update_loop(struct mailbox *mailbox,
                     if (r) goto out;
                 }
                 /* only increment master */
-                msg = mailbox_iter_step(iter);
+                msg = update_loop_step(iter, uids);
                 mrecord = msg ? msg_record(msg) : NULL;
             }
             else {
@@ -4978,7 +5067,7 @@ static int mailbox_update_loop(struct mailbox *mailbox,
                     if (r) goto out;
                 }
             }
-            msg = mailbox_iter_step(iter);
+            msg = update_loop_step(iter, uids);
             mrecord = msg ? msg_record(msg) : NULL;
         }
 
@@ -5007,10 +5096,128 @@ out:
     return r;
 }
 
+/* slices per SYNCCRCS request, and the size of UID range below which
+ * we stop asking and compare the records themselves */
+#define SYNC_CRC_SPLIT 16
+#define SYNC_CRC_LEAF 256
+
+/* append to @seq the UID ranges within @minuid..@maxuid where the
+ * replica's sync CRCs differ from ours.  If @relock is set, the index
+ * lock is dropped across each round trip to the replica and the
+ * descent gives up with IMAP_AGAIN if the mailbox changed meanwhile. */
+static int sync_crc_descend(struct mailbox *mailbox,
+                            uint32_t minuid, uint32_t maxuid,
+                            struct backend *sync_be, struct buf *seq,
+                            int relock)
+{
+    struct synccrcs crcs[SYNC_CRC_SPLIT];
+    struct dlist *kl, *kin = NULL, *kb = NULL, *ka = NULL, *bi, *ai;
+    modseq_t modseq = mailbox->i.highestmodseq;
+    unsigned i;
+    int r;
+
+    if (maxuid - minuid < SYNC_CRC_LEAF) {
+        if (seq->len) buf_putc(seq, ',');
+        buf_printf(seq, "%u:%u", minuid, maxuid);
+        return 0;
+    }
+
+    r = mailbox_synccrcs_range(mailbox, minuid, maxuid, SYNC_CRC_SPLIT, crcs);
+    if (r) return r;
+
+    if (relock) mailbox_unlock_index(mailbox, NULL);
+
+    kl = dlist_newkvlist(NULL, "SYNCCRCS");
+    dlist_setatom(kl, "MBOXNAME", mailbox->name);
+    dlist_setnum32(kl, "MINUID", minuid);
+    dlist_setnum32(kl, "MAXUID", maxuid);
+    dlist_setnum32(kl, "SPLIT", SYNC_CRC_SPLIT);
+    sync_send_lookup(kl, sync_be->out);
+    dlist_free(&kl);
+
+    r = sync_parse_response("SYNCCRCS", sync_be->in, &kin);
+    if (r) return r;
+
+    if (relock) {
+        r = mailbox_lock_index(mailbox, LOCK_SHARED);
+        if (!r && mailbox->i.highestmodseq != modseq) {
+            /* our CRCs are stale, the ranges would be meaningless */
+            r = IMAP_AGAIN;
+        }
+        if (r) goto done;
+    }
+
+    if (!kin->head ||
+        !dlist_getlist(kin->head, "BASIC", &kb) ||
+        !dlist_getlist(kin->head, "ANNOT", &ka)) {
+        r = IMAP_PROTOCOL_BAD_PARAMETERS;
+        goto done;
+    }
+
+    for (i = 0, bi = kb->head, ai = ka->head; i < SYNC_CRC_SPLIT;
+         i++, bi = bi->next, ai = ai->next) {
+        uint32_t low, high;
+
+        if (!bi || !ai) {
+            r = IMAP_PROTOCOL_BAD_PARAMETERS;
+            goto done;
+        }
+
+        if (crcs[i].basic == dlist_num(bi) && crcs[i].annot == dlist_num(ai))
+            continue;
+
+        mailbox_synccrcs_slice(minuid, maxuid, SYNC_CRC_SPLIT, i, &low, &high);
+        r = sync_crc_descend(mailbox, low, high, sync_be, seq, relock);
+        if (r) goto done;
+    }
+
+ done:
+    dlist_free(&kin);
+    return r;
+}
+
+/* the UIDs worth comparing record by record, or NULL for all of them */
+static struct seqset *sync_crc_divergent(struct mailbox *mailbox,
+                                         struct backend *sync_be,
+                                         int relock)
+{
+    static int unsupported = 0;
+    struct buf seq = BUF_INITIALIZER;
+    struct seqset *uids = NULL;
+    int r;
+
+    if (unsupported || mailbox->i.last_uid < SYNC_CRC_LEAF)
+        return NULL;
+
+    r = sync_crc_descend(mailbox, 1, mailbox->i.last_uid, sync_be, &seq,
+                         relock);
+    if (r == IMAP_PROTOCOL_ERROR) {
+        /* older replica, don't ask again */
+        syslog(LOG_NOTICE, "SYNCNOTICE: replica doesn't support SYNCCRCS");
+        unsupported = 1;
+    }
+
+    if (!r) {
+        /* and anything the replica has past our last UID */
+        if (seq.len) buf_putc(&seq, ',');
+        buf_printf(&seq, "%u:*", mailbox->i.last_uid + 1);
+        uids = seqset_parse(buf_cstring(&seq), NULL, UINT32_MAX);
+    }
+
+    buf_free(&seq);
+    return uids;
+}
+
+/*
+ * Compare every record with the replica and fix any differences.
+ * If @byrange is set, first narrow the comparison down to the UID
+ * ranges whose sync CRCs differ, so that a handful of mismatches
+ * in a large mailbox doesn't mean fetching every record.
+ */
 static int mailbox_full_update(struct sync_folder *local,
                                struct sync_reserve_list *reserve_list,
                                struct backend *sync_be,
-                               unsigned flags)
+                               unsigned flags, int byrange)
 {
     const char *cmd = "FULLMAILBOX";
     struct mailbox *mailbox = NULL;
@@ -5031,6 +5238,7 @@ static int mailbox_full_update(struct sync_folder *local,
     modseq_t xconvmodseq = 0;
     struct sync_msgid_list *part_list;
     annotate_state_t *astate = NULL;
+    struct seqset *uids = NULL;
 
     if (flags & SYNC_FLAG_VERBOSE)
         printf("%s %s\n", cmd, local->name);
@@ -5038,12 +5246,40 @@ static int mailbox_full_update(struct sync_folder *local,
     if (flags & SYNC_FLAG_LOGGING)
         syslog(LOG_INFO, "%s %s", cmd, local->name);
 
-    kl = dlist_setatom(NULL, cmd, local->name);
+    if (byrange) {
+        if (local->mailbox) {
+            /* the caller's lock, we can't drop it while we're asking */
+            uids = sync_crc_divergent(local->mailbox, sync_be, 0);
+        }
+        else {
+            /* only read-locked, and not across the round trips */
+            r = mailbox_open_irl(local->name, &mailbox);
+            if (r) goto done;
+
+            uids = sync_crc_divergent(mailbox, sync_be, 1);
+            mailbox_close(&mailbox);
+        }
+    }
+
+    if (uids) {
+        char *seq = seqset_cstring(uids);
+
+        if (flags & SYNC_FLAG_VERBOSE)
+            printf("%s %s UIDS %s\n", cmd, local->name, seq);
+
+        kl = dlist_newkvlist(NULL, cmd);
+        dlist_setatom(kl, "MBOXNAME", local->name);
+        dlist_setatom(kl, "UIDS", seq);
+        free(seq);
+    }
+    else {
+        kl = dlist_setatom(NULL, cmd, local->name);
+    }
     sync_send_lookup(kl, sync_be->out);
     dlist_free(&kl);
 
     r = sync_parse_response(cmd, sync_be->in, &kin);
-    if (r) return r;
+    if (r) goto done;
 
     kl = kin->head;
 
@@ -5124,7 +5360,7 @@ static int mailbox_full_update(struct sync_folder *local,
     annotate_state_begin(astate);
 
     r = mailbox_update_loop(mailbox, kr->head, last_uid,
-                            highestmodseq, NULL, part_list, sync_be);
+                            highestmodseq, NULL, part_list, sync_be, uids);
     if (r) {
         syslog(LOG_ERR, "SYNCNOTICE: failed to prepare update for %s: %s",
                mailbox->name, error_message(r));
@@ -5142,7 +5378,7 @@ static int mailbox_full_update(struct sync_folder *local,
 
     kaction = dlist_newlist(NULL, "ACTION");
     r = mailbox_update_loop(mailbox, kr->head, last_uid,
-                            highestmodseq, kaction, part_list, sync_be);
+                            highestmodseq, kaction, part_list, sync_be, uids);
     if (r) goto cleanup;
 
     /* if replica still has a higher last_uid, bump our local
@@ -5209,6 +5445,7 @@ done:
 
     if (mailbox && !local->mailbox) mailbox_close(&mailbox);
 
+    seqset_free(uids);
     dlist_free(&kin);
     dlist_free(&kaction);
     dlist_free(&kexpunge);
@@ -5348,7 +5585,8 @@ static int update_mailbox_once(struct sync_folder *local,
     if (!topart) topart = mailbox->part;
     part_list = sync_reserve_partlist(reserve_list, topart);
     r = sync_prepare_dlists(mailbox, local, remote, topart, part_list, kl,
-                            kupload, 1, /*XXX flags & SYNC_FLAG_FULLANNOTS*/1);
+                            kupload, 1, /*XXX flags & SYNC_FLAG_FULLANNOTS*/1,
+                            NULL);
     if (r) goto done;
 
     /* keep the mailbox locked for shorter time! Unlock the index now
@@ -5393,29 +5631,39 @@ int sync_update_mailbox(struct sync_folder *local,
                         struct backend *sync_be,
                         unsigned flags)
 {
-    int r = update_mailbox_once(local, remote, topart,
-                                reserve_list, sync_be, flags);
+    struct timeval start, end;
+    int r;
+
+    gettimeofday(&start, NULL);
+
+    r = update_mailbox_once(local, remote, topart,
+                            reserve_list, sync_be, flags);
 
     /* never retry - other end should always sync cleanly */
-    if (flags & SYNC_FLAG_NO_COPYBACK) return r;
+    if (flags & SYNC_FLAG_NO_COPYBACK) goto done;
 
     flags |= SYNC_FLAG_ISREPEAT;
 
     if (r == IMAP_AGAIN) {
         local->ispartial = 0; /* don't batch the re-update, means sync to 2.4 will still work after fullsync */
-        r = mailbox_full_update(local, reserve_list, sync_be, flags);
+        r = mailbox_full_update(local, reserve_list, sync_be, flags, 0);
         if (!r) r = update_mailbox_once(local, remote, topart,
                                         reserve_list, sync_be, flags);
     }
     else if (r == IMAP_SYNC_CHECKSUM) {
         syslog(LOG_ERR, "CRC failure on sync for %s, trying full update",
                local->name);
-        r = mailbox_full_update(local, reserve_list, sync_be, flags);
+        r = mailbox_full_update(local, reserve_list, sync_be, flags, 1);
         if (!r) r = update_mailbox_once(local, remote, topart,
                                         reserve_list, sync_be,
                                         flags|SYNC_FLAG_FULLANNOTS);
     }
 
+done:
+    gettimeofday(&end, NULL);
+    prometheus_observe(CYRUS_SYNC_MAILBOX_DURATION_SECONDS,
+                       timesub(&start, &end));
+
     return r;
 }
 
@@ -6251,6 +6499,8 @@ EXPORTED const char *sync_get(struct dlist *kin, struct sync_state *state)
         r = sync_get_meta(kin, state);
     else if (!strcmp(kin->name, "QUOTA"))
         r = sync_get_quota(kin, state);
+    else if (!strcmp(kin->name, "SYNCCRCS"))
+        r = sync_get_synccrcs(kin, state);
     else if (!strcmp(kin->name, "USER"))
         r = sync_get_user(kin, state);
     else
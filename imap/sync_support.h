@@ -468,6 +468,7 @@ int sync_get_annotation(struct dlist *kin, struct sync_state *sstate);
 int sync_get_quota(struct dlist *kin, struct sync_state *sstate);
 int sync_get_fullmailbox(struct dlist *kin, struct sync_state *sstate);
 int sync_get_mailboxes(struct dlist *kin, struct sync_state *sstate);
+int sync_get_synccrcs(struct dlist *kin, struct sync_state *sstate);
 int sync_get_meta(struct dlist *kin, struct sync_state *sstate);
 int sync_get_user(struct dlist *kin, struct sync_state *sstate);
 
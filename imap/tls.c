@@ -103,6 +103,9 @@
 /* System library. */
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
@@ -116,9 +119,18 @@
 #include <openssl/pem.h>
 #include <openssl/x509.h>
 #include <openssl/ssl.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#else
+#include <openssl/hmac.h>
+#endif
 
 /* Application-specific. */
 #include "assert.h"
+#include "byteorder64.h"
+#include "cyr_lock.h"
 #include "nonblock.h"
 #include "util.h"
 #include "xmalloc.h"
@@ -128,12 +140,32 @@
 /* Session caching/reuse stuff */
 #include "global.h"
 #include "cyrusdb.h"
+#include "prometheus.h"
 
 #define DB (config_tls_sessions_db) /* sessions are binary -> MUST use DB3 */
 
 static struct db *sessdb = NULL;
 static int sess_dbopen = 0;
 
+/* Stateless session resumption: session tickets encrypted with keys
+ * shared by all services through a small file, which is rotated by
+ * whichever process first notices that the newest key is too old. */
+#define TICKET_NKEYS 3          /* newest first */
+#define TICKET_CHECK_INTERVAL 60
+
+struct ticket_key {
+    unsigned char name[16];
+    unsigned char hmac[32];
+    unsigned char aes[32];
+    uint64_t created;
+};
+#define TICKET_KEY_SIZE (16 + 32 + 32 + 8)
+
+static struct ticket_key ticket_keys[TICKET_NKEYS];
+static int ticket_nkeys = 0;
+static time_t ticket_lifetime = 0;
+static time_t ticket_checked = 0;
+
 enum {
     var_imapd_tls_loglevel = 0,
     var_proxy_tls_loglevel = 0,
@@ -668,6 +700,228 @@ static SSL_SESSION *get_session_cb(SSL *ssl __attribute__((unused)),
     return sess;
 }
 
+static char *ticket_keys_fname(void)
+{
+    return strconcat(config_dir, FNAME_TLSTICKETKEYS, (char *)NULL);
+}
+
+/* read the shared ticket keys, adding a new one if the newest is
+ * older than the ticket lifetime.  returns 0 on success */
+static int ticket_keys_load(time_t now)
+{
+    unsigned char buf[TICKET_NKEYS * TICKET_KEY_SIZE], *p;
+    struct ticket_key keys[TICKET_NKEYS];
+    char *fname = ticket_keys_fname();
+    int fd, n, i, r = -1;
+    ssize_t len;
+
+    fd = open(fname, O_RDWR|O_CREAT, 0600);
+    if (fd < 0) {
+        syslog(LOG_ERR, "IOERROR: opening %s: %m", fname);
+        goto done;
+    }
+    if (lock_blocking(fd, fname)) {
+        syslog(LOG_ERR, "IOERROR: locking %s: %m", fname);
+        goto done;
+    }
+
+    len = pread(fd, buf, sizeof(buf), 0);
+    if (len < 0) {
+        syslog(LOG_ERR, "IOERROR: reading %s: %m", fname);
+        goto done;
+    }
+
+    for (n = 0, p = buf; n < TICKET_NKEYS && p + TICKET_KEY_SIZE <= buf + len;
+         n++, p += TICKET_KEY_SIZE) {
+        uint64_t created;
+
+        memcpy(keys[n].name, p, 16);
+        memcpy(keys[n].hmac, p + 16, 32);
+        memcpy(keys[n].aes, p + 48, 32);
+        memcpy(&created, p + 80, 8);
+        keys[n].created = ntohll(created);
+    }
+
+    if (!n || (time_t) keys[0].created + ticket_lifetime <= now) {
+        /* rotate: new key in front, oldest falls off the end */
+        uint64_t created = htonll((uint64_t) now);
+
+        if (n == TICKET_NKEYS) n--;
+        memmove(&keys[1], &keys[0], n * sizeof(struct ticket_key));
+        n++;
+
+        if (RAND_bytes(keys[0].name, sizeof(keys[0].name)) <= 0 ||
+            RAND_bytes(keys[0].hmac, sizeof(keys[0].hmac)) <= 0 ||
+            RAND_bytes(keys[0].aes, sizeof(keys[0].aes)) <= 0) {
+            syslog(LOG_ERR, "TLS server engine: cannot generate ticket key");
+            goto done;
+        }
+        keys[0].created = now;
+
+        for (i = 0, p = buf; i < n; i++, p += TICKET_KEY_SIZE) {
+            memcpy(p, keys[i].name, 16);
+            memcpy(p + 16, keys[i].hmac, 32);
+            memcpy(p + 48, keys[i].aes, 32);
+            created = htonll((uint64_t) keys[i].created);
+            memcpy(p + 80, &created, 8);
+        }
+
+        len = n * TICKET_KEY_SIZE;
+        if (pwrite(fd, buf, len, 0) != len || fsync(fd)) {
+            syslog(LOG_ERR, "IOERROR: writing %s: %m", fname);
+            goto done;
+        }
+    }
+
+    memcpy(ticket_keys, keys, n * sizeof(struct ticket_key));
+    ticket_nkeys = n;
+    r = 0;
+
+ done:
+    if (fd >= 0) {
+        lock_unlock(fd, fname);
+        close(fd);
+    }
+    free(fname);
+    memset(buf, 0, sizeof(buf));
+    memset(keys, 0, sizeof(keys));
+    return r;
+}
+
+static void ticket_keys_refresh(int force)
+{
+    time_t now = time(NULL);
+
+    if (!force && ticket_nkeys && now - ticket_checked < TICKET_CHECK_INTERVAL &&
+        (time_t) ticket_keys[0].created + ticket_lifetime > now)
+        return;
+
+    ticket_checked = now;
+    /* on failure, keep using the keys we have */
+    ticket_keys_load(now);
+}
+
+static const struct ticket_key *ticket_key_find(const unsigned char *name,
+                                                int *idx)
+{
+    int i;
+
+    for (i = 0; i < ticket_nkeys; i++) {
+        if (!memcmp(name, ticket_keys[i].name, sizeof(ticket_keys[i].name))) {
+            *idx = i;
+            return &ticket_keys[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Choose the key for a session ticket: the newest key when issuing one
+ * (filling in its name and a fresh IV), otherwise the key named by the
+ * ticket.  Returns the result for the ticket key callback, with *keyp
+ * set if it is positive. */
+static int ticket_key_select(unsigned char key_name[16], unsigned char *iv,
+                             int enc, const struct ticket_key **keyp)
+{
+    int idx = 0;
+
+    if (enc) {
+        /* issue a new ticket with the newest key */
+        ticket_keys_refresh(0);
+        if (!ticket_nkeys) return -1;
+        *keyp = &ticket_keys[0];
+
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) <= 0)
+            return -1;
+
+        memcpy(key_name, (*keyp)->name, sizeof((*keyp)->name));
+        return 1;
+    }
+
+    *keyp = ticket_key_find(key_name, &idx);
+    if (!*keyp) {
+        /* maybe another process has rotated since we last looked */
+        ticket_keys_refresh(1);
+        *keyp = ticket_key_find(key_name, &idx);
+    }
+    if (!*keyp) {
+        /* unknown or expired key: fall back to a full handshake */
+        prometheus_increment(CYRUS_TLS_SESSION_TICKETS_TOTAL_RESULT_UNKNOWN);
+        return 0;
+    }
+
+    /* good, but if encrypted with an older key: issue a fresh ticket */
+    return idx ? 2 : 1;
+}
+
+static void ticket_key_count(int enc, int r)
+{
+    if (enc)
+        prometheus_increment(CYRUS_TLS_SESSION_TICKETS_TOTAL_RESULT_ISSUED);
+    else if (r == 2)
+        prometheus_increment(CYRUS_TLS_SESSION_TICKETS_TOTAL_RESULT_RENEWED);
+    else
+        prometheus_increment(CYRUS_TLS_SESSION_TICKETS_TOTAL_RESULT_RESUMED);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int ticket_key_cb(SSL *ssl __attribute__((unused)),
+                         unsigned char key_name[16], unsigned char *iv,
+                         EVP_CIPHER_CTX *ectx, EVP_MAC_CTX *hctx, int enc)
+{
+    const struct ticket_key *key = NULL;
+    OSSL_PARAM params[3];
+    int r;
+
+    r = ticket_key_select(key_name, iv, enc, &key);
+    if (r <= 0) return r;
+
+    params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+                                                  (void *) key->hmac,
+                                                  sizeof(key->hmac));
+    params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+                                                 (char *) "SHA256", 0);
+    params[2] = OSSL_PARAM_construct_end();
+
+    if (!EVP_MAC_CTX_set_params(hctx, params))
+        return -1;
+
+    if (enc) {
+        if (!EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, key->aes, iv))
+            return -1;
+    }
+    else if (!EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, key->aes, iv))
+        return -1;
+
+    ticket_key_count(enc, r);
+    return r;
+}
+#else
+static int ticket_key_cb(SSL *ssl __attribute__((unused)),
+                         unsigned char key_name[16], unsigned char *iv,
+                         EVP_CIPHER_CTX *ectx, HMAC_CTX *hctx, int enc)
+{
+    const struct ticket_key *key = NULL;
+    int r;
+
+    r = ticket_key_select(key_name, iv, enc, &key);
+    if (r <= 0) return r;
+
+    if (!HMAC_Init_ex(hctx, key->hmac, sizeof(key->hmac), EVP_sha256(), NULL))
+        return -1;
+
+    if (enc) {
+        if (!EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, key->aes, iv))
+            return -1;
+    }
+    else if (!EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, key->aes, iv))
+        return -1;
+
+    ticket_key_count(enc, r);
+    return r;
+}
+#endif /* OPENSSL_VERSION_NUMBER >= 0x30000000L */
+
 /*
  * Seed the random number generator.
  */
@@ -1009,6 +1263,23 @@ EXPORTED int     tls_init_serverengine(const char *ident,
         /* Set the timeout for the internal/external cache (in seconds) */
         SSL_CTX_set_timeout(s_ctx, timeout*60);
 
+        if (config_getswitch(IMAPOPT_TLS_SESSION_TICKETS)) {
+            /* Stateless resumption using shared ticket keys,
+               nothing is written on the handshake path */
+            ticket_lifetime = timeout*60;
+            ticket_keys_refresh(1);
+            if (ticket_nkeys) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+                SSL_CTX_set_tlsext_ticket_key_evp_cb(s_ctx, ticket_key_cb);
+#else
+                SSL_CTX_set_tlsext_ticket_key_cb(s_ctx, ticket_key_cb);
+#endif
+                goto done_cache;
+            }
+            syslog(LOG_ERR, "TLS server engine: no session ticket keys, "
+                   "falling back to the session cache");
+        }
+
         /* Set the callback functions for the external session cache */
         SSL_CTX_sess_set_new_cb(s_ctx, new_session_cb);
         SSL_CTX_sess_set_remove_cb(s_ctx, remove_session_cb);
@@ -1033,6 +1304,7 @@ EXPORTED int     tls_init_serverengine(const char *ident,
         free(tofree);
     }
 
+ done_cache:
     tls_serverengine = 1;
     if (ret) *ret = s_ctx;
 
@@ -52,6 +52,7 @@ int tls_enabled(void);
 
 /* name of the SSL/TLS sessions database */
 #define FNAME_TLSSESSIONS "/tls_sessions.db"
+#define FNAME_TLSTICKETKEYS "/tls_ticketkeys"
 
 #ifdef HAVE_SSL
 
@@ -41,6 +41,12 @@
  */
 
 #include <config.h>
+#include <ctype.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "global.h"
+#include "util.h"
 #include "xstats.h"
 
 
@@ -50,3 +56,59 @@ EXPORTED const char *xstats_names[XSTATS_NUM_METRICS] = {
 #include "xstats_metrics.h"
 #undef X
 };
+
+EXPORTED void xstats_snapshot(struct xstats_snapshot *snap)
+{
+    gettimeofday(&snap->start, NULL);
+    getrusage(RUSAGE_SELF, &snap->rusage);
+    snap->db = cyrusdb_stats;
+    memcpy(snap->counters, xstats, sizeof(snap->counters));
+}
+
+EXPORTED double xstats_elapsed(const struct xstats_snapshot *snap)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return timesub(&snap->start, &now);
+}
+
+/*
+ * Log a structured record of everything consumed since 'snap' was taken.
+ * Counters are 32b wrapping, so unsigned differences are still correct.
+ */
+EXPORTED void xstats_trace(const struct xstats_snapshot *snap,
+                           const char *cmdname, const char *userid,
+                           const char *mboxname)
+{
+    struct xstats_snapshot now;
+    struct buf buf = BUF_INITIALIZER;
+    const char *p;
+    int metric;
+
+    xstats_snapshot(&now);
+
+    buf_printf(&buf, "cmdtrace: sessionid=<%s> userid=<%s> mailbox=<%s>"
+                     " command=<%s>",
+               session_id(), userid ? userid : "",
+               mboxname ? mboxname : "", cmdname);
+    buf_printf(&buf, " elapsed=<%f> utime=<%f> stime=<%f>",
+               timesub(&snap->start, &now.start),
+               timesub(&snap->rusage.ru_utime, &now.rusage.ru_utime),
+               timesub(&snap->rusage.ru_stime, &now.rusage.ru_stime));
+    buf_printf(&buf, " db_fetch=<%u> db_foreach=<%u> db_store=<%u>",
+               now.db.fetch - snap->db.fetch,
+               now.db.foreach - snap->db.foreach,
+               now.db.store - snap->db.store);
+
+    for (metric = 0 ; metric < XSTATS_NUM_METRICS ; metric++) {
+        buf_putc(&buf, ' ');
+        for (p = xstats_names[metric]; *p; p++)
+            buf_putc(&buf, tolower((unsigned char) *p));
+        buf_printf(&buf, "=<%u>",
+                   now.counters[metric] - snap->counters[metric]);
+    }
+
+    syslog(LOG_NOTICE, "%s", buf_cstring(&buf));
+    buf_free(&buf);
+}
@@ -49,6 +49,10 @@
 # include <stdint.h>
 #endif
 #include <config.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "cyrusdb.h"
 
 #define _PASTE(a,b)             a##b
 #define _STRINGIFY(x)           #x
@@ -66,6 +70,21 @@ extern const char *xstats_names[XSTATS_NUM_METRICS];
 #define xstats_inc(m)           (xstats[_PASTE(XSTATS_,m)]++)
 #define xstats_add(m, x)        (xstats[_PASTE(XSTATS_,m)] += (x))
 
+/* Per-command resource accounting: take a snapshot when the command
+ * starts and pass it to xstats_trace() when it ends */
+struct xstats_snapshot {
+    struct timeval start;
+    struct rusage rusage;
+    struct cyrusdb_stats db;
+    uint32_t counters[XSTATS_NUM_METRICS];
+};
+
+extern void xstats_snapshot(struct xstats_snapshot *snap);
+extern double xstats_elapsed(const struct xstats_snapshot *snap);
+extern void xstats_trace(const struct xstats_snapshot *snap,
+                         const char *cmdname, const char *userid,
+                         const char *mboxname);
+
 /*-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-*/
 
 #endif /* __CYRUS_IMAP_XSTATS_H__ */
@@ -51,3 +51,7 @@ X(SEARCH_CACHE_HEADER),
 X(SEARCH_BODY),
 X(SEARCH_TRIVIAL),
 X(SEARCH_RESULT),
+X(MESSAGE_PARSE),
+X(SPOOL_READ_BYTES),
+X(SPOOL_WRITE_BYTES),
+X(MAILBOX_LOCK_WAIT_USEC),
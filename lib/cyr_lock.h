@@ -51,12 +51,21 @@
 #endif
 #endif
 
+#include <sys/types.h>
 #include <sys/stat.h>
 
 extern const char *lock_method_desc;
 
 extern double debug_locks_longer_than;
 
+/* If set, called after every blocking lock is obtained with the number
+ * of seconds spent waiting for it.  'holder' is the pid of a process
+ * which held a conflicting lock when we started waiting, or 0 if the
+ * lock was uncontended or the lock method can't tell us. */
+typedef void lock_wait_cb(const char *filename, int exclusive,
+                          double waited, pid_t holder);
+extern lock_wait_cb *lock_wait_observer;
+
 extern int lock_reopen_ex(int fd, const char *filename,
                           struct stat *sbuf, const char **failaction,
                           int *changed);
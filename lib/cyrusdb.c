@@ -85,6 +85,8 @@ struct db {
     struct cyrusdb_backend *backend;
 };
 
+EXPORTED struct cyrusdb_stats cyrusdb_stats;
+
 static struct cyrusdb_backend *cyrusdb_fromname(const char *name)
 {
     int i;
@@ -198,6 +200,7 @@ EXPORTED int cyrusdb_fetch(struct db *db,
 {
     if (!db->backend->fetch)
         return CYRUSDB_NOTIMPLEMENTED;
+    cyrusdb_stats.fetch++;
     return db->backend->fetch(db->engine, key, keylen,
                               data, datalen, mytid);
 }
@@ -209,6 +212,7 @@ EXPORTED int cyrusdb_fetchlock(struct db *db,
 {
     if (!db->backend->fetchlock)
         return CYRUSDB_NOTIMPLEMENTED;
+    cyrusdb_stats.fetch++;
     return db->backend->fetchlock(db->engine, key, keylen,
                                   data, datalen, mytid);
 }
@@ -221,6 +225,7 @@ EXPORTED int cyrusdb_fetchnext(struct db *db,
 {
     if (!db->backend->fetchnext)
         return CYRUSDB_NOTIMPLEMENTED;
+    cyrusdb_stats.fetch++;
     return db->backend->fetchnext(db->engine, key, keylen,
                                   found, foundlen,
                                   data, datalen, mytid);
@@ -234,6 +239,7 @@ EXPORTED int cyrusdb_foreach(struct db *db,
 {
     if (!db->backend->foreach)
         return CYRUSDB_NOTIMPLEMENTED;
+    cyrusdb_stats.foreach++;
     return db->backend->foreach(db->engine, prefix, prefixlen,
                                 p, cb, rock, tid);
 }
@@ -262,6 +268,7 @@ EXPORTED int cyrusdb_create(struct db *db,
 {
     if (!db->backend->create)
         return CYRUSDB_NOTIMPLEMENTED;
+    cyrusdb_stats.store++;
     return db->backend->create(db->engine, key, keylen, data, datalen, tid);
 }
 
@@ -272,6 +279,7 @@ EXPORTED int cyrusdb_store(struct db *db,
 {
     if (!db->backend->store)
         return CYRUSDB_NOTIMPLEMENTED;
+    cyrusdb_stats.store++;
     return db->backend->store(db->engine, key, keylen, data, datalen, tid);
 }
 
@@ -281,6 +289,7 @@ EXPORTED int cyrusdb_delete(struct db *db,
 {
     if (!db->backend->delete_)
         return CYRUSDB_NOTIMPLEMENTED;
+    cyrusdb_stats.store++;
     return db->backend->delete_(db->engine, key, keylen, tid, force);
 }
 
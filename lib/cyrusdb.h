@@ -43,6 +43,7 @@
 #define INCLUDED_CYRUSDB_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include "strarray.h"
 
 struct db;
@@ -247,6 +248,15 @@ extern const char *cyrusdb_detect(const char *fname);
 void cyrusdb_init(void);
 void cyrusdb_done(void);
 
+/* Running per-process operation counts (32b wrapping), for resource
+ * accounting.  Take the difference of two copies to get a delta. */
+struct cyrusdb_stats {
+    uint32_t fetch;     /* fetch, fetchlock, fetchnext */
+    uint32_t foreach;
+    uint32_t store;     /* create, store, delete */
+};
+extern struct cyrusdb_stats cyrusdb_stats;
+
 /* direct DB interface */
 extern int cyrusdb_open(const char *backend, const char *fname,
                         int flags, struct db **ret);
@@ -0,0 +1,276 @@
+/* hashmap.c -- open addressing string hash map
+ *
+ * Copyright (c) 1994-2017 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashmap.h"
+#include "xmalloc.h"
+
+#define HASHMAP_MIN_SLOTS 8
+
+/* grow when more than 7/8 of the slots would be in use */
+#define HASHMAP_FULL(nslots) ((nslots) - (nslots) / 8)
+
+#define HASHMAP_NOTFOUND ((size_t) -1)
+
+/*
+ * FNV-1a, followed by the murmur3 finaliser so that the low bits we
+ * mask on depend on the whole key.  Zero is reserved for empty slots.
+ */
+static uint32_t hashmap_hash(const char *key, size_t *lenp)
+{
+    const unsigned char *p = (const unsigned char *) key;
+    uint32_t h = 2166136261U;
+
+    for ( ; *p; p++) {
+        h ^= *p;
+        h *= 16777619U;
+    }
+    *lenp = p - (const unsigned char *) key;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+
+    return h ? h : 1;
+}
+
+static inline const char *slot_key(const struct hashmap_slot *slot)
+{
+    return slot->keylen < HASHMAP_INLINE_KEY ? slot->k.inline_key : slot->k.key;
+}
+
+/* how far the entry in slot @i has been pushed from its home slot */
+static inline size_t slot_dist(const struct hashmap *map, size_t i)
+{
+    return (i - map->slots[i].hash) & map->mask;
+}
+
+static size_t hashmap_find(const struct hashmap *map, const char *key,
+                           uint32_t hash, size_t keylen)
+{
+    size_t i, dist;
+
+    if (!map->slots) return HASHMAP_NOTFOUND;
+
+    for (i = hash & map->mask, dist = 0; ; i = (i + 1) & map->mask, dist++) {
+        const struct hashmap_slot *slot = &map->slots[i];
+
+        if (!slot->hash)
+            return HASHMAP_NOTFOUND;
+
+        /* the key would have displaced an entry this close to home */
+        if (slot_dist(map, i) < dist)
+            return HASHMAP_NOTFOUND;
+
+        if (slot->hash == hash && slot->keylen == keylen &&
+            !memcmp(slot_key(slot), key, keylen))
+            return i;
+    }
+}
+
+/*
+ * Put an entry (which isn't already in the map) into place, taking
+ * the slot of any entry that is closer to its home than we are and
+ * carrying on with that one instead.
+ */
+static void hashmap_place(struct hashmap *map, struct hashmap_slot *ins)
+{
+    struct hashmap_slot tmp;
+    size_t i, dist;
+
+    for (i = ins->hash & map->mask, dist = 0; ; i = (i + 1) & map->mask, dist++) {
+        struct hashmap_slot *slot = &map->slots[i];
+        size_t d;
+
+        if (!slot->hash) {
+            *slot = *ins;
+            return;
+        }
+
+        d = slot_dist(map, i);
+        if (d < dist) {
+            tmp = *slot;
+            *slot = *ins;
+            *ins = tmp;
+            dist = d;
+        }
+    }
+}
+
+static void hashmap_resize(struct hashmap *map, size_t nslots)
+{
+    struct hashmap_slot *old = map->slots;
+    size_t i, nold = old ? map->mask + 1 : 0;
+
+    map->slots = xzmalloc(nslots * sizeof(struct hashmap_slot));
+    map->mask = nslots - 1;
+
+    for (i = 0; i < nold; i++) {
+        if (old[i].hash)
+            hashmap_place(map, &old[i]);
+    }
+
+    free(old);
+}
+
+EXPORTED void hashmap_init(struct hashmap *map, size_t size)
+{
+    size_t nslots = HASHMAP_MIN_SLOTS;
+
+    while (HASHMAP_FULL(nslots) < size)
+        nslots *= 2;
+
+    map->count = 0;
+    map->mask = 0;
+    map->slots = NULL;
+    hashmap_resize(map, nslots);
+}
+
+EXPORTED void hashmap_fini(struct hashmap *map, void (*func)(void *))
+{
+    size_t i;
+
+    if (!map->slots) return;
+
+    for (i = 0; i <= map->mask; i++) {
+        struct hashmap_slot *slot = &map->slots[i];
+
+        if (!slot->hash) continue;
+        if (func) func(slot->data);
+        if (slot->keylen >= HASHMAP_INLINE_KEY) free(slot->k.key);
+    }
+
+    free(map->slots);
+    map->slots = NULL;
+    map->mask = 0;
+    map->count = 0;
+}
+
+EXPORTED void *hashmap_insert(struct hashmap *map, const char *key, void *data)
+{
+    struct hashmap_slot ins;
+    size_t keylen, i;
+    uint32_t hash = hashmap_hash(key, &keylen);
+
+    i = hashmap_find(map, key, hash, keylen);
+    if (i != HASHMAP_NOTFOUND) {
+        void *old = map->slots[i].data;
+        map->slots[i].data = data;
+        return old;
+    }
+
+    if (!map->slots)
+        hashmap_resize(map, HASHMAP_MIN_SLOTS);
+    else if (map->count + 1 > HASHMAP_FULL(map->mask + 1))
+        hashmap_resize(map, 2 * (map->mask + 1));
+
+    memset(&ins, 0, sizeof(ins));
+    ins.hash = hash;
+    ins.keylen = keylen;
+    ins.data = data;
+    if (keylen < HASHMAP_INLINE_KEY)
+        memcpy(ins.k.inline_key, key, keylen + 1);
+    else
+        ins.k.key = xstrndup(key, keylen);
+
+    hashmap_place(map, &ins);
+    map->count++;
+
+    return data;
+}
+
+EXPORTED void *hashmap_lookup(const struct hashmap *map, const char *key)
+{
+    size_t keylen, i;
+    uint32_t hash = hashmap_hash(key, &keylen);
+
+    i = hashmap_find(map, key, hash, keylen);
+    return i == HASHMAP_NOTFOUND ? NULL : map->slots[i].data;
+}
+
+EXPORTED void *hashmap_del(struct hashmap *map, const char *key)
+{
+    size_t keylen, i, next;
+    uint32_t hash = hashmap_hash(key, &keylen);
+    void *data;
+
+    i = hashmap_find(map, key, hash, keylen);
+    if (i == HASHMAP_NOTFOUND) return NULL;
+
+    data = map->slots[i].data;
+    if (map->slots[i].keylen >= HASHMAP_INLINE_KEY)
+        free(map->slots[i].k.key);
+
+    /* pull back the entries after it which aren't in their home slot,
+     * so that lookups never need tombstones */
+    for (next = (i + 1) & map->mask;
+         map->slots[next].hash && slot_dist(map, next);
+         i = next, next = (next + 1) & map->mask) {
+        map->slots[i] = map->slots[next];
+    }
+    memset(&map->slots[i], 0, sizeof(struct hashmap_slot));
+    map->count--;
+
+    return data;
+}
+
+EXPORTED void hashmap_enumerate(const struct hashmap *map,
+                                void (*func)(const char *, void *, void *),
+                                void *rock)
+{
+    size_t i;
+
+    if (!map->slots) return;
+
+    for (i = 0; i <= map->mask; i++) {
+        const struct hashmap_slot *slot = &map->slots[i];
+
+        if (slot->hash)
+            func(slot_key(slot), slot->data, rock);
+    }
+}
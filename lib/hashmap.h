@@ -0,0 +1,103 @@
+/* hashmap.h -- open addressing string hash map
+ *
+ * Copyright (c) 1994-2017 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __CYRUS_HASHMAP_H__
+#define __CYRUS_HASHMAP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A string keyed hash map using open addressing with Robin Hood linear
+ * probing.  Unlike hash_table, the slots live in one flat array which
+ * doubles whenever it gets too full, so the size passed to
+ * hashmap_init() is only a hint, and keys shorter than
+ * HASHMAP_INLINE_KEY are stored in the slot itself rather than in a
+ * separate allocation.
+ *
+ * The map must not be inserted into or deleted from while it is being
+ * enumerated, though replacing the data of an existing key is fine.
+ */
+
+#define HASHMAP_INLINE_KEY 24
+
+struct hashmap_slot {
+    uint32_t hash;              /* 0 means the slot is empty */
+    uint32_t keylen;
+    void *data;
+    union {
+        char inline_key[HASHMAP_INLINE_KEY];
+        char *key;
+    } k;
+};
+
+struct hashmap {
+    size_t count;
+    size_t mask;                /* number of slots - 1 */
+    struct hashmap_slot *slots;
+};
+
+#define HASHMAP_INITIALIZER { 0, 0, NULL }
+
+/* size the map for about @size entries; it will grow past that */
+extern void hashmap_init(struct hashmap *map, size_t size);
+
+/* free the map, calling @func (if not NULL) on the data of every entry */
+extern void hashmap_fini(struct hashmap *map, void (*func)(void *));
+
+/* Insert @data under a copy of @key.  Returns @data for a new key, or
+ * the previous data if @key was already present (which is replaced) */
+extern void *hashmap_insert(struct hashmap *map, const char *key, void *data);
+
+/* returns the data for @key, or NULL if it isn't present */
+extern void *hashmap_lookup(const struct hashmap *map, const char *key);
+
+/* removes @key, returning its data or NULL if it wasn't present */
+extern void *hashmap_del(struct hashmap *map, const char *key);
+
+extern void hashmap_enumerate(const struct hashmap *map,
+                              void (*func)(const char *, void *, void *),
+                              void *rock);
+
+#define hashmap_count(map) ((map)->count)
+
+#endif /* __CYRUS_HASHMAP_H__ */
@@ -50,12 +50,59 @@
 #include "cyr_lock.h"
 
 #include <syslog.h>
+#include <sys/time.h>
 #include <time.h>
 
 EXPORTED const char *lock_method_desc = "fcntl";
 
 EXPORTED double debug_locks_longer_than = 0.0;
 
+EXPORTED lock_wait_cb *lock_wait_observer = NULL;
+
+/*
+ * Block until we obtain a lock of 'type' on 'fd'.  If we have to wait,
+ * find out who we're waiting for first and store their pid in 'holder'.
+ */
+static int lock_wait(int fd, int type, pid_t *holder)
+{
+    struct flock fl;
+    int r;
+
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = 0;
+    fl.l_len = 0;
+    r = fcntl(fd, F_SETLK, &fl);
+    if (r != -1 || (errno != EACCES && errno != EAGAIN)) return r;
+
+    /* contended - F_GETLK overwrites fl with the conflicting lock */
+    if (fcntl(fd, F_GETLK, &fl) != -1 && fl.l_type != F_UNLCK)
+        *holder = fl.l_pid;
+
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = 0;
+    fl.l_len = 0;
+    return fcntl(fd, F_SETLKW, &fl);
+}
+
+static void lock_report(const char *what, const char *filename, int exclusive,
+                        const struct timeval *starttime, pid_t holder)
+{
+    struct timeval endtime;
+    double locktime;
+
+    gettimeofday(&endtime, 0);
+    locktime = (double)(endtime.tv_sec - starttime->tv_sec) +
+               (double)(endtime.tv_usec - starttime->tv_usec)/1000000.0;
+
+    if (debug_locks_longer_than && locktime > debug_locks_longer_than)
+        syslog(LOG_NOTICE, "locktimer: %s %s (%0.2fs)", what, filename, locktime);
+
+    if (lock_wait_observer)
+        lock_wait_observer(filename, exclusive, locktime, holder);
+}
+
 /*
  * Block until we obtain an exclusive lock on the file descriptor 'fd',
  * opened for reading and writing on the file named 'filename'.  If
@@ -75,22 +122,18 @@ EXPORTED int lock_reopen_ex(int fd, const char *filename,
                             int *changed)
 {
     int r;
-    struct flock fl;
     struct stat sbuffile, sbufspare;
     int newfd;
+    pid_t holder = 0;
     struct timeval starttime;
-    if (debug_locks_longer_than)
+    if (debug_locks_longer_than || lock_wait_observer)
         gettimeofday(&starttime, 0);
 
 
     if (!sbuf) sbuf = &sbufspare;
 
     for (;;) {
-        fl.l_type= F_WRLCK;
-        fl.l_whence = SEEK_SET;
-        fl.l_start = 0;
-        fl.l_len = 0;
-        r = fcntl(fd, F_SETLKW, &fl);
+        r = lock_wait(fd, F_WRLCK, &holder);
         if (r == -1) {
             if (errno == EINTR) continue;
             if (failaction) *failaction = "locking";
@@ -106,14 +149,9 @@ EXPORTED int lock_reopen_ex(int fd, const char *filename,
         }
 
         if (sbuf->st_ino == sbuffile.st_ino) {
-            if (debug_locks_longer_than) {
-                struct timeval endtime;
-                gettimeofday(&endtime, 0);
-                double locktime = (double)(endtime.tv_sec - starttime.tv_sec) +
-                                  (double)(endtime.tv_usec - starttime.tv_usec)/1000000.0;
-                if (locktime > debug_locks_longer_than) /* 10ms */
-                    syslog(LOG_NOTICE, "locktimer: reopen %s (%0.2fs)", filename, locktime);
-            }
+            if (debug_locks_longer_than || lock_wait_observer)
+                lock_report("reopen", filename, /*exclusive*/1,
+                            &starttime, holder);
             return 0;
         }
 
@@ -145,26 +183,25 @@ EXPORTED int lock_setlock(int fd, int exclusive, int nonblock,
     int r;
     struct flock fl;
     int type = (exclusive ? F_WRLCK : F_RDLCK);
-    int cmd = (nonblock ? F_SETLK : F_SETLKW);
+    pid_t holder = 0;
     struct timeval starttime;
-    if (debug_locks_longer_than)
+    if (debug_locks_longer_than || lock_wait_observer)
         gettimeofday(&starttime, 0);
 
     for (;;) {
-        fl.l_type= type;
-        fl.l_whence = SEEK_SET;
-        fl.l_start = 0;
-        fl.l_len = 0;
-        r = fcntl(fd, cmd, &fl);
+        if (nonblock) {
+            fl.l_type= type;
+            fl.l_whence = SEEK_SET;
+            fl.l_start = 0;
+            fl.l_len = 0;
+            r = fcntl(fd, F_SETLK, &fl);
+        }
+        else {
+            r = lock_wait(fd, type, &holder);
+        }
         if (r != -1) {
-            if (debug_locks_longer_than) {
-                struct timeval endtime;
-                gettimeofday(&endtime, 0);
-                double locktime = (double)(endtime.tv_sec - starttime.tv_sec) +
-                                  (double)(endtime.tv_usec - starttime.tv_usec)/1000000.0;
-                if (locktime > debug_locks_longer_than)
-                    syslog(LOG_NOTICE, "locktimer: reopen %s (%0.2fs)", filename, locktime);
-            }
+            if (!nonblock && (debug_locks_longer_than || lock_wait_observer))
+                lock_report("setlock", filename, exclusive, &starttime, holder);
             return 0;
         }
         if (errno == EINTR) continue;
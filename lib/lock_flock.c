@@ -43,6 +43,7 @@
 #include <config.h>
 #include <sys/file.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <fcntl.h>
 #include <errno.h>
 #ifdef HAVE_UNISTD_H
@@ -53,6 +54,21 @@
 
 EXPORTED const char *lock_method_desc = "flock";
 
+EXPORTED lock_wait_cb *lock_wait_observer = NULL;
+
+/* flock() can't tell us who holds a lock, so there is never a holder */
+static void lock_report(const char *filename, int exclusive,
+                        const struct timeval *starttime)
+{
+    struct timeval endtime;
+
+    gettimeofday(&endtime, 0);
+    lock_wait_observer(filename, exclusive,
+                       (double)(endtime.tv_sec - starttime->tv_sec) +
+                       (double)(endtime.tv_usec - starttime->tv_usec)/1000000.0,
+                       0);
+}
+
 /*
  * Block until we obtain an exclusive lock on the file descriptor 'fd',
  * opened for reading and writing on the file named 'filename'.  If
@@ -74,6 +90,10 @@ EXPORTED int lock_reopen_ex(int fd, const char *filename,
     int r;
     struct stat sbuffile, sbufspare;
     int newfd;
+    struct timeval starttime;
+
+    if (lock_wait_observer)
+        gettimeofday(&starttime, 0);
 
     if (!sbuf) sbuf = &sbufspare;
 
@@ -93,7 +113,11 @@ EXPORTED int lock_reopen_ex(int fd, const char *filename,
             return -1;
         }
 
-        if (sbuf->st_ino == sbuffile.st_ino) return 0;
+        if (sbuf->st_ino == sbuffile.st_ino) {
+            if (lock_wait_observer)
+                lock_report(filename, /*exclusive*/1, &starttime);
+            return 0;
+        }
 
         if (changed) *changed = 1;
 
@@ -118,15 +142,23 @@ EXPORTED int lock_reopen_ex(int fd, const char *filename,
  * appropriate error code.
  */
 EXPORTED int lock_setlock(int fd, int exclusive, int nonblock,
-                          const char *filename __attribute__((unused)))
+                          const char *filename)
 {
     int r;
     int op = (exclusive ? LOCK_EX : LOCK_SH);
+    struct timeval starttime;
     if (nonblock) op |= LOCK_NB;
 
+    if (!nonblock && lock_wait_observer)
+        gettimeofday(&starttime, 0);
+
     for (;;) {
         r = flock(fd, op);
-        if (r != -1) return 0;
+        if (r != -1) {
+            if (!nonblock && lock_wait_observer)
+                lock_report(filename, exclusive, &starttime);
+            return 0;
+        }
         if (errno == EINTR) continue;
         return -1;
     }
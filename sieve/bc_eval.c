@@ -56,6 +56,7 @@
 
 #include "bytecode.h"
 #include "bc_parse.h"
+#include "strmatch.h"
 
 #include "charset.h"
 #include "xmalloc.h"
@@ -94,6 +95,89 @@ static regex_t * bc_compile_regex(const char *s, int ctag,
     return reg;
 }
 
+/* Compiled :regex patterns, keyed by "cflags:pattern".  lmtpd loads
+ * and unloads the script for every delivery, so the cache belongs to
+ * the process rather than the bytecode; the same patterns come round
+ * again on the next message, whichever script they came from.  It is
+ * simply emptied when it grows past REGEX_CACHE_MAX entries. */
+#define REGEX_CACHE_MAX 1024
+static hash_table regex_cache = HASH_TABLE_INITIALIZER;
+static int regex_cache_count = 0;
+
+static void free_regex(void *reg)
+{
+    regfree((regex_t *) reg);
+    free(reg);
+}
+
+/* Look up a compiled regular expression in the cache, compiling and
+ * caching it on first use.  The returned regex is owned by the cache. */
+static regex_t *bc_cached_regex(const char *s, int ctag,
+                                char *errmsg, size_t errsiz)
+{
+    struct buf key = BUF_INITIALIZER;
+    regex_t *reg;
+
+    if (regex_cache_count >= REGEX_CACHE_MAX) {
+        free_hash_table(&regex_cache, &free_regex);
+        regex_cache_count = 0;
+    }
+    if (!regex_cache.size) construct_hash_table(&regex_cache, 256, 0);
+
+    buf_printf(&key, "%x:%s", ctag, s);
+    reg = hash_lookup(buf_cstring(&key), &regex_cache);
+    if (!reg) {
+        reg = bc_compile_regex(s, ctag, errmsg, errsiz);
+        if (reg) {
+            hash_insert(buf_cstring(&key), reg, &regex_cache);
+            regex_cache_count++;
+        }
+    }
+    buf_free(&key);
+
+    return reg;
+}
+
+/* Return a single-pass matcher for a :is/:contains string list, built
+ * on first use and cached with the loaded bytecode, or NULL if the list
+ * has to be compared needle by needle. */
+static const strmatch_t *bc_strmatch(sieve_bytecode_t *bc_cur,
+                                     strarray_t *needles, int match,
+                                     int comparator, int requires)
+{
+    hash_table *cache = &bc_cur->strmatch_cache;
+    const char *first = strarray_nth(needles, 0);
+    strmatch_t *sm;
+    char key[32];
+    int n;
+
+    if ((match != B_IS && match != B_CONTAINS) ||
+        (comparator != B_OCTET && comparator != B_ASCIICASEMAP) ||
+        strarray_size(needles) < STRMATCH_MIN_NEEDLES || !first) {
+        return NULL;
+    }
+
+    /* the needles point into the mapped bytecode,
+       so the offset of the first one identifies the list */
+    snprintf(key, sizeof(key), "%lx", (unsigned long) (first - bc_cur->data));
+
+    if (!cache->size) construct_hash_table(cache, 64, 0);
+    else if ((sm = hash_lookup(key, cache))) return sm;
+
+    for (n = 0; n < strarray_size(needles); n++) {
+        const char *needle = strarray_nth(needles, n);
+
+        /* variable references have to be expanded per message */
+        if (!needle || ((requires & BFE_VARIABLES) && strstr(needle, "${")))
+            return NULL;
+    }
+
+    sm = strmatch_new(needles, match, comparator == B_ASCIICASEMAP);
+    hash_insert(key, sm, cache);
+
+    return sm;
+}
+
 /* Determine if addr is a system address */
 static int sysaddr(const char *addr)
 {
@@ -337,7 +421,7 @@ static int do_comparison(const char *needle, const char *hay,
 
     if (ctag) {
         char errbuf[100]; /* Basically unused, as regex tested at compile */
-        regex_t *reg = bc_compile_regex(needle, ctag, errbuf, sizeof(errbuf));
+        regex_t *reg = bc_cached_regex(needle, ctag, errbuf, sizeof(errbuf));
 
         if (!reg) {
             /* Oops */
@@ -346,8 +430,6 @@ static int do_comparison(const char *needle, const char *hay,
         else {
             res = comp(hay, strlen(hay),
                        (const char *) reg, match_vars, comprock);
-            regfree(reg);
-            free(reg);
         }
     } else {
 #if VERBOSE
@@ -384,6 +466,7 @@ static int do_comparisons(strarray_t *needles, const char *hay,
 /* Evaluate a bytecode test */
 static int eval_bc_test(sieve_interp_t *interp, void* m, void *sc,
                         bytecode_input_t * bc, int * ip,
+                        sieve_bytecode_t *bc_cur,
 			variable_list_t *variables,
                         duptrack_list_t *duptrack_list,
                         int version, int requires)
@@ -414,8 +497,8 @@ static int eval_bc_test(sieve_interp_t *interp, void* m, void *sc,
         break;
 
     case BC_NOT:
-        res = eval_bc_test(interp, m, sc, bc, &i, variables,
-                           duptrack_list, version, requires);
+        res = eval_bc_test(interp, m, sc, bc, &i, bc_cur,
+                           variables, duptrack_list, version, requires);
         if (res >= 0) res = !res; /* Only invert in non-error case */
         break;
 
@@ -469,8 +552,9 @@ static int eval_bc_test(sieve_interp_t *interp, void* m, void *sc,
         /* need to process all of them, to ensure our instruction pointer stays
          * in the right place */
         for (x = 0; x < list_len && !res; x++) {
-            int tmp = eval_bc_test(interp, m, sc, bc, &i, variables,
-                                   duptrack_list, version, requires);
+            int tmp = eval_bc_test(interp, m, sc, bc, &i, bc_cur,
+                                   variables, duptrack_list,
+                                   version, requires);
             if (tmp < 0) {
                 res = tmp;
                 break;
@@ -489,8 +573,9 @@ static int eval_bc_test(sieve_interp_t *interp, void* m, void *sc,
 
         /* return 1 unless you find one that isn't true, then return 0 */
         for (x = 0; x < list_len && res; x++) {
-            int tmp =  eval_bc_test(interp, m, sc, bc, &i, variables,
-                                    duptrack_list, version, requires);
+            int tmp =  eval_bc_test(interp, m, sc, bc, &i, bc_cur,
+                                    variables, duptrack_list,
+                                    version, requires);
             if (tmp < 0) {
                 res = tmp;
                 break;
@@ -522,6 +607,7 @@ static int eval_bc_test(sieve_interp_t *interp, void* m, void *sc,
         int count = 0;
         int isReg = (match == B_REGEX);
         int ctag = 0;
+        const strmatch_t *sm;
 
         /* set up variables needed for compiling regex */
         if (isReg) {
@@ -537,6 +623,8 @@ static int eval_bc_test(sieve_interp_t *interp, void* m, void *sc,
         }
         match_vars = varlist_select(variables, VL_MATCH_VARS)->var;
 
+        sm = bc_strmatch(bc_cur, test.u.ae.pl, match, comparator, requires);
+
         /* loop through all the headers */
 #if VERBOSE
         printf("about to process %d headers\n", numheaders);
@@ -632,6 +720,8 @@ static int eval_bc_test(sieve_interp_t *interp, void* m, void *sc,
 
                     if (match == B_COUNT) {
                         count++;
+                    } else if (sm) {
+                        res = strmatch_test(sm, addr, strlen(addr));
                     } else {
                         /* search through all the data */
                         res = do_comparisons(test.u.ae.pl, addr,
@@ -685,6 +775,7 @@ envelope_err:
         int isReg = (match == B_REGEX);
         int ctag = 0;
         char *decoded_header;
+        const strmatch_t *sm;
 
         /* set up variables needed for compiling regex */
         if (isReg) {
@@ -700,6 +791,8 @@ envelope_err:
         }
         match_vars = varlist_select(variables, VL_MATCH_VARS)->var;
 
+        sm = bc_strmatch(bc_cur, test.u.hhs.pl, match, comparator, requires);
+
         /* search through all the flags for the header */
         for(x = 0; x < numheaders && !res; x++) {
             const char *this_header;
@@ -750,10 +843,16 @@ envelope_err:
                     decoded_header =
                         charset_parse_mimeheader(val[y], 0 /*flags*/);
 
-                    res = do_comparisons(test.u.hhs.pl, decoded_header,
-                                         comp, comprock, ctag,
-                                         (requires & BFE_VARIABLES) ?
-                                         variables : NULL, match_vars);
+                    if (sm) {
+                        res = strmatch_test(sm, decoded_header,
+                                            strlen(decoded_header));
+                    }
+                    else {
+                        res = do_comparisons(test.u.hhs.pl, decoded_header,
+                                             comp, comprock, ctag,
+                                             (requires & BFE_VARIABLES) ?
+                                             variables : NULL, match_vars);
+                    }
                     free(decoded_header);
 
                     if (res < 0) goto header_err;
@@ -1687,7 +1786,7 @@ int sieve_eval_bc(sieve_execute_t *exe, int is_incl, sieve_interp_t *i,
             int testend = cmd.u.i.testend;
             int result;
 
-            result = eval_bc_test(i, m, sc, bc, &ip, variables,
+            result = eval_bc_test(i, m, sc, bc, &ip, bc_cur, variables,
                                 duptrack_list, version, requires);
 
             if (result < 0) {
@@ -1862,9 +1961,9 @@ int sieve_eval_bc(sieve_execute_t *exe, int is_incl, sieve_interp_t *i,
             if (comparator == B_REGEX) {
                 char errmsg[1024]; /* Basically unused */
 
-                reg = bc_compile_regex(pattern,
-                                       REG_EXTENDED | REG_NOSUB | REG_ICASE,
-                                       errmsg, sizeof(errmsg));
+                reg = bc_cached_regex(pattern,
+                                      REG_EXTENDED | REG_NOSUB | REG_ICASE,
+                                      errmsg, sizeof(errmsg));
                 if (!reg) {
                     res = SIEVE_RUN_ERROR;
                     break;
@@ -1873,11 +1972,6 @@ int sieve_eval_bc(sieve_execute_t *exe, int is_incl, sieve_interp_t *i,
 
             res = do_denotify(notify_list, comp, reg,
                               match_vars, comprock, priority);
-
-            if (reg) {
-                regfree(reg);
-                free(reg);
-            }
             break;
         }
 
@@ -68,6 +68,7 @@
 #include "bytecode.h"
 #include "libconfig.h"
 #include "varlist.h"
+#include "strmatch.h"
 
 /* generated by the yacc script */
 int sieveparse(sieve_script_t *script);
@@ -508,6 +509,11 @@ EXPORTED int sieve_script_load(const char *fname, sieve_execute_t **ret)
 
 
 
+static void free_strmatch(void *sm)
+{
+    strmatch_free((strmatch_t **) &sm);
+}
+
 EXPORTED int sieve_script_unload(sieve_execute_t **s)
 {
     if(s && *s) {
@@ -518,6 +524,8 @@ EXPORTED int sieve_script_unload(sieve_execute_t **s)
         while (bc) {
             map_free(&(bc->data), &(bc->len));
             close(bc->fd);
+            if (bc->strmatch_cache.size)
+                free_hash_table(&bc->strmatch_cache, &free_strmatch);
             nextbc = bc->next;
             free(bc);
             bc = nextbc;
@@ -49,6 +49,7 @@
 #include "sieve_interface.h"
 #include "interp.h"
 #include "tree.h"
+#include "hash.h"
 #include "util.h"
 
 struct sieve_script {
@@ -75,6 +76,9 @@ struct sieve_bytecode {
 
     int is_executing;           /* used to prevent recursive INCLUDEs */
 
+    hash_table strmatch_cache;  /* strmatch_t for long :is/:contains string
+                                   lists, keyed by bytecode offset */
+
     sieve_bytecode_t *next;
 };
 
@@ -0,0 +1,281 @@
+/* strmatch.c -- multi-pattern string list matching
+ *
+ * Copyright (c) 1994-2008 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <ctype.h>
+#include <string.h>
+
+#include "bytecode.h"
+#include "hash.h"
+#include "strmatch.h"
+#include "util.h"
+#include "xmalloc.h"
+
+#define AC_NONE ((unsigned) -1)
+
+struct ac_edge {
+    unsigned char c;
+    unsigned next;
+};
+
+struct ac_node {
+    struct ac_edge *edges;      /* sorted by c */
+    unsigned nedges;
+    unsigned fail;
+    int out;                    /* a needle ends here (or at a suffix) */
+};
+
+struct strmatch {
+    int match;
+    int casemap;
+
+    /* B_IS */
+    hash_table set;
+
+    /* B_CONTAINS */
+    struct ac_node *nodes;
+    unsigned nnodes;
+    unsigned alloc;
+};
+
+static inline unsigned char fold(const strmatch_t *sm, unsigned char c)
+{
+    return sm->casemap ? toupper(c) : c;
+}
+
+static unsigned ac_goto(const strmatch_t *sm, unsigned state, unsigned char c)
+{
+    const struct ac_node *node = &sm->nodes[state];
+    unsigned lo = 0, hi = node->nedges;
+
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+
+        if (node->edges[mid].c == c) return node->edges[mid].next;
+        if (node->edges[mid].c < c) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return AC_NONE;
+}
+
+static unsigned ac_newnode(strmatch_t *sm)
+{
+    if (sm->nnodes == sm->alloc) {
+        sm->alloc = sm->alloc ? 2 * sm->alloc : 64;
+        sm->nodes = xrealloc(sm->nodes, sm->alloc * sizeof(struct ac_node));
+    }
+    memset(&sm->nodes[sm->nnodes], 0, sizeof(struct ac_node));
+
+    return sm->nnodes++;
+}
+
+static void ac_add(strmatch_t *sm, const char *needle)
+{
+    unsigned state = 0;
+
+    for (; *needle; needle++) {
+        unsigned char c = fold(sm, *needle);
+        unsigned next = ac_goto(sm, state, c);
+
+        if (next == AC_NONE) {
+            struct ac_node *node;
+            unsigned i;
+
+            next = ac_newnode(sm);
+            node = &sm->nodes[state];
+
+            /* insert the edge keeping the list sorted */
+            node->edges = xrealloc(node->edges,
+                                   (node->nedges + 1) * sizeof(struct ac_edge));
+            for (i = node->nedges; i > 0 && node->edges[i-1].c > c; i--) {
+                node->edges[i] = node->edges[i-1];
+            }
+            node->edges[i].c = c;
+            node->edges[i].next = next;
+            node->nedges++;
+        }
+        state = next;
+    }
+
+    sm->nodes[state].out = 1;
+}
+
+/* compute failure links breadth first, so a node's fail target is
+   always finished before the node itself */
+static void ac_link(strmatch_t *sm)
+{
+    unsigned *queue = xmalloc(sm->nnodes * sizeof(unsigned));
+    unsigned head = 0, tail = 0, i;
+
+    for (i = 0; i < sm->nodes[0].nedges; i++) {
+        unsigned v = sm->nodes[0].edges[i].next;
+
+        sm->nodes[v].fail = 0;
+        queue[tail++] = v;
+    }
+
+    while (head < tail) {
+        unsigned u = queue[head++];
+
+        for (i = 0; i < sm->nodes[u].nedges; i++) {
+            unsigned char c = sm->nodes[u].edges[i].c;
+            unsigned v = sm->nodes[u].edges[i].next;
+            unsigned f = sm->nodes[u].fail;
+            unsigned g;
+
+            while ((g = ac_goto(sm, f, c)) == AC_NONE && f)
+                f = sm->nodes[f].fail;
+
+            sm->nodes[v].fail = (g == AC_NONE) ? 0 : g;
+            if (sm->nodes[sm->nodes[v].fail].out) sm->nodes[v].out = 1;
+
+            queue[tail++] = v;
+        }
+    }
+
+    free(queue);
+}
+
+strmatch_t *strmatch_new(const strarray_t *needles,
+                         int match, int casemap)
+{
+    strmatch_t *sm;
+    int i;
+
+    if (match != B_IS && match != B_CONTAINS) return NULL;
+
+    sm = xzmalloc(sizeof(strmatch_t));
+    sm->match = match;
+    sm->casemap = casemap;
+
+    if (match == B_IS) {
+        struct buf key = BUF_INITIALIZER;
+
+        construct_hash_table(&sm->set, 2 * strarray_size(needles) + 1, 0);
+
+        for (i = 0; i < strarray_size(needles); i++) {
+            const char *p;
+
+            buf_reset(&key);
+            for (p = strarray_nth(needles, i); *p; p++)
+                buf_putc(&key, fold(sm, *p));
+
+            hash_insert(buf_cstring(&key), (void *) 1, &sm->set);
+        }
+
+        buf_free(&key);
+    }
+    else {
+        ac_newnode(sm);  /* root */
+
+        for (i = 0; i < strarray_size(needles); i++)
+            ac_add(sm, strarray_nth(needles, i));
+
+        ac_link(sm);
+    }
+
+    return sm;
+}
+
+int strmatch_test(const strmatch_t *sm, const char *hay, size_t len)
+{
+    size_t i;
+
+    if (sm->match == B_IS) {
+        struct buf key = BUF_INITIALIZER;
+        int r;
+
+        if (sm->casemap) {
+            for (i = 0; i < len; i++) buf_putc(&key, fold(sm, hay[i]));
+        }
+        else {
+            buf_setmap(&key, hay, len);
+        }
+
+        r = (hash_lookup(buf_cstring(&key), (hash_table *) &sm->set) != NULL);
+        buf_free(&key);
+
+        return r;
+    }
+    else {
+        unsigned state = 0;
+
+        /* an empty needle is contained in everything */
+        if (sm->nodes[0].out) return 1;
+
+        for (i = 0; i < len; i++) {
+            unsigned char c = fold(sm, hay[i]);
+            unsigned next;
+
+            while ((next = ac_goto(sm, state, c)) == AC_NONE && state)
+                state = sm->nodes[state].fail;
+
+            state = (next == AC_NONE) ? 0 : next;
+            if (sm->nodes[state].out) return 1;
+        }
+
+        return 0;
+    }
+}
+
+void strmatch_free(strmatch_t **smp)
+{
+    strmatch_t *sm = *smp;
+    unsigned i;
+
+    if (!sm) return;
+
+    if (sm->match == B_IS) {
+        free_hash_table(&sm->set, NULL);
+    }
+    else {
+        for (i = 0; i < sm->nnodes; i++) free(sm->nodes[i].edges);
+        free(sm->nodes);
+    }
+
+    free(sm);
+    *smp = NULL;
+}
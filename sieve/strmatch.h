@@ -0,0 +1,71 @@
+/* strmatch.h -- multi-pattern string list matching
+ *
+ * Copyright (c) 1994-2008 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SIEVE_STRMATCH_H
+#define SIEVE_STRMATCH_H
+
+#include "strarray.h"
+
+/*
+ * A strmatch_t answers "does any string in this list match?" for a
+ * :is or :contains comparison under i;octet or i;ascii-casemap in a
+ * single pass over the haystack, rather than one comparison per needle.
+ * :is lists become a hashed set, :contains lists an Aho-Corasick
+ * automaton.
+ */
+typedef struct strmatch strmatch_t;
+
+/* Lists shorter than this are cheaper to compare needle by needle */
+#define STRMATCH_MIN_NEEDLES 4
+
+/* Build a matcher for 'needles' using match type 'match' (B_IS or
+ * B_CONTAINS).  If 'casemap' is set, comparisons ignore ASCII case.
+ * Returns NULL if the match type is not supported. */
+strmatch_t *strmatch_new(const strarray_t *needles,
+                         int match, int casemap);
+
+/* Returns 1 if any needle matches 'hay', 0 otherwise */
+int strmatch_test(const strmatch_t *sm, const char *hay, size_t len);
+
+void strmatch_free(strmatch_t **smp);
+
+#endif /* SIEVE_STRMATCH_H */